@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <stb_image.h>
+
+#include "benchmarks.h"
+#include "bvh.h"
+#include "entity_store.h"
+#include "frustum.h"
+#include "image_decoder.h"
+#include "job_system.h"
+#include "transform_hierarchy.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// repeats fn for at least minMs and returns the average time of one call
+template <typename Fn>
+static double timeMs(Fn fn, double minMs = 200.0)
+{
+    unsigned int runs = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        fn();
+        runs++;
+    } while (elapsedMs(start) < minMs);
+    return elapsedMs(start) / runs;
+}
+
+// object count from the first argument, the default if it's missing or not a positive number
+static uint32_t countArg(const std::vector<std::string> &args, uint32_t fallback)
+{
+    if (args.empty())
+        return fallback;
+    
+    const char *text = args[0].c_str();
+    char *end;
+    unsigned long count = strtoul(text, &end, 10);
+    if (!isdigit((unsigned char) *text) || *end || !count || count > UINT32_MAX) {
+        std::cout << "Invalid count '" << args[0] << "', using " << fallback << std::endl;
+        return fallback;
+    }
+    return (uint32_t) count;
+}
+
+// === culling ============================================
+
+static void benchmarkCulling()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(projection * view);
+    
+    std::cout << "frustum culling, simd path: " << cullBoundsPath() << std::endl;
+    
+    for (size_t count : { 10000, 100000, 1000000 }) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> extent(0.5f, 2.0f);
+        
+        BoundsSoA bounds;
+        bounds.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            float e = extent(rng);
+            bounds.set(i, glm::vec3(position(rng), position(rng), position(rng)), glm::vec3(e));
+        }
+        
+        std::vector<uint32_t> visible;
+        visible.reserve(count);
+        
+        double scalar = timeMs([&] { visible.clear(); cullBoundsScalar(frustum, bounds, visible); });
+        double simd = timeMs([&] { visible.clear(); cullBounds(frustum, bounds, visible); });
+        
+        std::cout << "  " << count << " objects, " << visible.size() << " visible" << std::endl;
+        std::cout << "    scalar: " << count / scalar << " objects/ms" << std::endl;
+        std::cout << "    simd:   " << count / simd << " objects/ms" << std::endl;
+    }
+}
+
+// === bvh ================================================
+
+static void benchmarkBvh()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(projection * view);
+    
+    std::cout << "bvh" << std::endl;
+    
+    for (size_t count : { 10000, 100000, 1000000 }) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> extent(0.5f, 2.0f);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        
+        std::vector<Aabb> bounds(count);
+        BoundsSoA soa;
+        soa.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 center(position(rng), position(rng), position(rng));
+            glm::vec3 e(extent(rng));
+            bounds[i].min = center - e;
+            bounds[i].max = center + e;
+            soa.set(i, center, e);
+        }
+        
+        Bvh bvh;
+        Clock::time_point start = Clock::now();
+        bvh.build(bounds);
+        double build = elapsedMs(start);
+        
+        double refit = timeMs([&] { bvh.refit(bounds); });
+        
+        std::vector<uint32_t> visible;
+        visible.reserve(count);
+        double linear = timeMs([&] { visible.clear(); cullBounds(frustum, soa, visible); });
+        size_t linearVisible = visible.size();
+        double hierarchical = timeMs([&] { visible.clear(); bvh.cull(frustum, visible); });
+        
+        // a fixed set of rays from the origin into the scene
+        std::vector<glm::vec3> directions(1000);
+        for (glm::vec3 &d : directions)
+            d = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.0f, 0.0f, -1.0f));
+        unsigned int hits = 0;
+        double rays = timeMs([&] {
+            hits = 0;
+            for (const glm::vec3 &d : directions) {
+                float distance;
+                hits += bvh.raycast(glm::vec3(0.0f), d, distance) >= 0;
+            }
+        });
+        
+        std::cout << "  " << count << " objects, " << bvh.nodeCount() << " nodes" << std::endl;
+        std::cout << "    build:       " << build << " ms" << std::endl;
+        std::cout << "    refit:       " << refit << " ms" << std::endl;
+        std::cout << "    linear cull: " << linear << " ms, " << linearVisible << " visible" << std::endl;
+        std::cout << "    bvh cull:    " << hierarchical << " ms, " << visible.size() << " visible" << std::endl;
+        std::cout << "    raycast:     " << directions.size() / rays << " rays/ms, "
+                  << hits << "/" << directions.size() << " hit" << std::endl;
+    }
+}
+
+// === png decode =========================================
+
+typedef unsigned char* (*DecodeFn)(const std::string &path, int &width, int &height, int &channels, int desired);
+
+static unsigned char* stbDecode(const std::string &path, int &width, int &height, int &channels, int desired)
+{
+    return stbi_load(path.c_str(), &width, &height, &channels, desired);
+}
+
+// every file once, returns the decoded bytes
+static size_t decodeAll(DecodeFn decode, const std::vector<std::string> &files)
+{
+    size_t bytes = 0;
+    for (const std::string &file : files) {
+        int width, height, channels;
+        unsigned char *pixels = decode(file, width, height, channels, 0);
+        if (pixels)
+            bytes += (size_t) width * height * channels;
+        stbi_image_free(pixels);
+    }
+    return bytes;
+}
+
+// each thread decodes the whole corpus, like texture workers loading unrelated images
+static double decodeParallel(DecodeFn decode, const std::vector<std::string> &files, unsigned int threads)
+{
+    return timeMs([&] {
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back([&] { decodeAll(decode, files); });
+        for (std::thread &worker : workers)
+            worker.join();
+    });
+}
+
+static void benchmarkPng(const std::vector<std::string> &args)
+{
+    std::vector<std::string> files = args;
+    if (files.empty()) {
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(".", error))
+            if (entry.path().extension() == ".png")
+                files.push_back(entry.path().string());
+    }
+    if (files.empty()) {
+        std::cout << "No png files given or found in the working directory" << std::endl;
+        return;
+    }
+    
+    std::cout << "png decode, fast path: " << decodeImagePath() << std::endl;
+    
+    for (const std::string &file : files) {
+        int width, height, channels, fastWidth, fastHeight, fastChannels;
+        unsigned char *reference = stbi_load(file.c_str(), &width, &height, &channels, 0);
+        unsigned char *pixels = decodeImage(file, fastWidth, fastHeight, fastChannels, 0);
+        if (!reference || !pixels) {
+            std::cout << "  " << file << ": failed to decode" << std::endl;
+            stbi_image_free(reference);
+            stbi_image_free(pixels);
+            continue;
+        }
+        
+        size_t bytes = (size_t) width * height * channels;
+        bool match = fastWidth == width && fastHeight == height && fastChannels == channels
+                  && !memcmp(reference, pixels, bytes);
+        stbi_image_free(reference);
+        stbi_image_free(pixels);
+        
+        std::vector<std::string> one = { file };
+        double stb = timeMs([&] { decodeAll(stbDecode, one); });
+        double scalar = timeMs([&] { decodeAll(decodeImageScalar, one); });
+        double simd = timeMs([&] { decodeAll(decodeImage, one); });
+        
+        std::cout << "  " << file << ", " << width << "x" << height << "x" << channels
+                  << (match ? "" : ", OUTPUT DIFFERS FROM STB_IMAGE") << std::endl;
+        std::cout << "    stb_image: " << bytes / 1000.0 / stb << " MB/s" << std::endl;
+        std::cout << "    scalar:    " << bytes / 1000.0 / scalar << " MB/s" << std::endl;
+        std::cout << "    simd:      " << bytes / 1000.0 / simd << " MB/s" << std::endl;
+    }
+    
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t bytes = decodeAll(stbDecode, files) * threads;
+    double stb = decodeParallel(stbDecode, files, threads);
+    double simd = decodeParallel(decodeImage, files, threads);
+    std::cout << "  " << threads << " threads, " << files.size() << " files each" << std::endl;
+    std::cout << "    stb_image: " << bytes / 1000.0 / stb << " MB/s" << std::endl;
+    std::cout << "    simd:      " << bytes / 1000.0 / simd << " MB/s" << std::endl;
+}
+
+// === job system =========================================
+
+// one frame of the renderer's cpu work: move every object, cull the bounds
+// in chunks and build the matrices of the visible ones
+static void benchmarkJobs(const std::vector<std::string> &args)
+{
+    uint32_t count = countArg(args, 1000000);
+    const uint32_t CHUNK = 16384;
+    
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(projection * view);
+    
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::vector<glm::vec3> positions(count);
+    for (glm::vec3 &p : positions)
+        p = glm::vec3(position(rng), position(rng), position(rng));
+    
+    BoundsSoA bounds;
+    bounds.resize(count);
+    std::vector<std::vector<uint32_t>> chunks((count + CHUNK - 1) / CHUNK);
+    std::vector<uint32_t> visible;
+    std::vector<glm::mat4> models;
+    visible.reserve(count);
+    models.reserve(count);
+    
+    auto model = [&](uint32_t i, float angle) {
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), positions[i]);
+        return glm::rotate(m, angle + i * 0.001f, glm::vec3(0.5f, 1.0f, 0.0f));
+    };
+    
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < cores; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+    
+    std::cout << "job system, " << count << " objects, " << cores << " cores" << std::endl;
+    
+    double single = 0.0;
+    for (unsigned int threads : threadCounts) {
+        JobSystem jobs;
+        jobs.create(threads);
+        
+        float angle = 0.0f;
+        double frame = timeMs([&] {
+            angle += 0.01f;
+            
+            jobs.parallelFor(0, count, 4096, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; i++) {
+                    glm::mat4 m = model(i, angle);
+                    glm::vec3 extent;
+                    for (int axis = 0; axis < 3; axis++)
+                        extent[axis] = 0.5f * (fabs(m[0][axis]) + fabs(m[1][axis]) + fabs(m[2][axis]));
+                    bounds.set(i, glm::vec3(m[3][0], m[3][1], m[3][2]), extent);
+                }
+            });
+            
+            jobs.parallelFor(0, chunks.size(), 1, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t chunk = begin; chunk < end; chunk++) {
+                    chunks[chunk].clear();
+                    cullBounds(frustum, bounds, size_t(chunk) * CHUNK, std::min<size_t>(size_t(chunk + 1) * CHUNK, count), chunks[chunk]);
+                }
+            });
+            
+            visible.clear();
+            for (const std::vector<uint32_t> &chunk : chunks)
+                visible.insert(visible.end(), chunk.begin(), chunk.end());
+            
+            models.resize(visible.size());
+            jobs.parallelFor(0, visible.size(), 1024, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; i++)
+                    models[i] = model(visible[i], angle);
+            });
+        }, 1000.0);
+        
+        jobs.destroy();
+        
+        if (threads == 1)
+            single = frame;
+        std::cout << "  " << threads << " threads: " << frame << " ms/frame, "
+                  << single / frame << "x, " << visible.size() << " visible" << std::endl;
+    }
+}
+
+// === entities ===========================================
+
+// dense iteration over the component arrays, before and after punching
+// random holes into the store, against the same data as an array of structs
+static void benchmarkEntities(const std::vector<std::string> &args)
+{
+    uint32_t count = countArg(args, 1000000);
+    
+    struct Object
+    {
+        glm::vec3 position, axis;
+        float spin, scale;
+        glm::mat4 world;
+        glm::vec3 center, extent;
+        uint16_t mesh, material;
+    };
+    
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    
+    EntityStore store;
+    std::vector<Object> objects(count);
+    std::vector<Entity> handles(count);
+    
+    Clock::time_point start = Clock::now();
+    store.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        EntityDesc desc;
+        desc.position = glm::vec3(position(rng), position(rng), position(rng));
+        desc.axis = glm::vec3(unit(rng), unit(rng), 1.0f);
+        desc.spin = unit(rng);
+        handles[i] = store.create(desc);
+        
+        Object &object = objects[i];
+        object.position = desc.position;
+        object.axis = glm::normalize(desc.axis);
+        object.spin = desc.spin;
+        object.scale = desc.scale;
+    }
+    double create = elapsedMs(start);
+    
+    // the same matrices and boxes the store's transform passes build, one object at a time
+    auto updateObjects = [&](float time) {
+        for (Object &object : objects) {
+            float angle = object.spin * time;
+            float c = std::cos(angle), s = std::sin(angle), t = 1.0f - c;
+            float x = object.axis.x, y = object.axis.y, z = object.axis.z, k = object.scale;
+            glm::mat4 &m = object.world;
+            m[0][0] = (t * x * x + c) * k; m[0][1] = (t * x * y + s * z) * k; m[0][2] = (t * x * z - s * y) * k; m[0][3] = 0.0f;
+            m[1][0] = (t * x * y - s * z) * k; m[1][1] = (t * y * y + c) * k; m[1][2] = (t * y * z + s * x) * k; m[1][3] = 0.0f;
+            m[2][0] = (t * x * z + s * y) * k; m[2][1] = (t * y * z - s * x) * k; m[2][2] = (t * z * z + c) * k; m[2][3] = 0.0f;
+            m[3][0] = object.position.x; m[3][1] = object.position.y; m[3][2] = object.position.z; m[3][3] = 1.0f;
+            object.center = object.position;
+            for (int axis = 0; axis < 3; axis++)
+                object.extent[axis] = 0.5f * (std::fabs(m[0][axis]) + std::fabs(m[1][axis]) + std::fabs(m[2][axis]));
+        }
+    };
+    
+    // a pass that only reads positions, where the layouts differ the most
+    auto sumSoA = [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < store.size(); i++)
+            sum += store.px[i] + store.py[i] + store.pz[i];
+        return sum;
+    };
+    auto sumAoS = [&] {
+        float sum = 0.0f;
+        for (const Object &object : objects)
+            sum += object.position.x + object.position.y + object.position.z;
+        return sum;
+    };
+    
+    auto updateStore = [&](float time) {
+        store.updateLocals(0, store.size(), time);
+        store.updateWorlds();
+        store.updateBounds(0, store.size());
+    };
+    
+    volatile float sink = 0.0f;
+    float time = 0.0f;
+    double soaUpdate = timeMs([&] { updateStore(time += 0.01f); });
+    double aosUpdate = timeMs([&] { updateObjects(time += 0.01f); });
+    double soaSum = timeMs([&] { sink = sink + sumSoA(); });
+    double aosSum = timeMs([&] { sink = sink + sumAoS(); });
+    
+    JobSystem jobs;
+    jobs.create();
+    double parallelUpdate = timeMs([&] {
+        time += 0.01f;
+        jobs.parallelFor(0, store.size(), 2048, [&](uint32_t begin, uint32_t end) {
+            store.updateLocals(begin, end, time);
+        });
+        store.updateWorlds();
+        jobs.parallelFor(0, store.size(), 2048, [&](uint32_t begin, uint32_t end) {
+            store.updateBounds(begin, end);
+        });
+    });
+    
+    // destroy a random quarter, the survivors stay packed at the front
+    std::shuffle(handles.begin(), handles.end(), rng);
+    start = Clock::now();
+    for (uint32_t i = 0; i < count / 4; i++)
+        store.destroy(handles[i]);
+    double destroy = elapsedMs(start);
+    
+    size_t found = 0;
+    double lookup = timeMs([&] {
+        found = 0;
+        for (uint32_t i = count / 4; i < count; i++)
+            found += store.alive(handles[i]) && store.px[store.slot(handles[i])] != 1e30f;
+    });
+    // the first update after the removals sorts the hierarchy again
+    start = Clock::now();
+    updateStore(time += 0.01f);
+    double resort = elapsedMs(start);
+    double holedUpdate = timeMs([&] { updateStore(time += 0.01f); });
+    
+    std::cout << "entity store, " << count << " entities" << std::endl;
+    std::cout << "  create:              " << create << " ms" << std::endl;
+    std::cout << "  transform soa:       " << soaUpdate << " ms" << std::endl;
+    std::cout << "  transform aos:       " << aosUpdate << " ms" << std::endl;
+    std::cout << "  transform parallel:  " << parallelUpdate << " ms, " << jobs.threadCount() << " threads" << std::endl;
+    std::cout << "  position pass soa:   " << soaSum << " ms" << std::endl;
+    std::cout << "  position pass aos:   " << aosSum << " ms" << std::endl;
+    std::cout << "  destroy a quarter:   " << destroy << " ms" << std::endl;
+    std::cout << "  random lookup:       " << lookup << " ms, " << found << " alive" << std::endl;
+    std::cout << "  first update after:  " << resort << " ms" << std::endl;
+    std::cout << "  transform after:     " << holedUpdate << " ms, " << store.size() << " entities" << std::endl;
+    
+    jobs.destroy();
+}
+
+// === transform hierarchy ================================
+
+// full recomputation against the dirty subtrees only, on a wide hierarchy
+// (many children per root) and a deep one (long chains)
+static void benchmarkHierarchy(const std::vector<std::string> &args)
+{
+    uint32_t count = countArg(args, 1000000);
+    uint32_t branch = std::max(2u, (uint32_t) std::sqrt((double) count));
+    
+    std::cout << "transform hierarchy, " << count << " nodes, kernel: " << transformRangePath() << std::endl;
+    
+    for (bool deep : { false, true }) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        auto randomLocal = [&] {
+            glm::mat4 local = glm::rotate(glm::mat4(1.0f), unit(rng), glm::vec3(unit(rng), unit(rng), 1.0f));
+            local[3] = glm::vec4(unit(rng), unit(rng), unit(rng), 1.0f);
+            return local;
+        };
+        
+        // added depth first, the same layout goes into the flat arrays for the scalar pass
+        TransformHierarchy hierarchy;
+        std::vector<uint32_t> parents(count);
+        std::vector<glm::mat4> locals(count), worlds(count);
+        for (uint32_t i = 0; i < count; i++) {
+            bool root = i % branch == 0;
+            uint32_t parent = root ? TransformHierarchy::NO_PARENT : deep ? i - 1 : i - i % branch;
+            locals[i] = randomLocal();
+            parents[i] = parent;
+            hierarchy.add(parent, locals[i]);
+        }
+        hierarchy.updateAll();
+        
+        // one percent of the nodes move every frame
+        std::vector<uint32_t> moving(count / 100);
+        for (uint32_t &node : moving)
+            node = rng() % count;
+        
+        double scalar = timeMs([&] { transformRangeScalar(parents.data(), locals.data(), worlds.data(), 0, count); });
+        double full = timeMs([&] { hierarchy.updateAll(); });
+        size_t updated = 0;
+        double dirty = timeMs([&] {
+            for (uint32_t node : moving)
+                hierarchy.setLocal(node, locals[node]);
+            updated = hierarchy.update();
+        });
+        
+        std::cout << "  " << (deep ? "deep, " : "wide, ") << count / branch << " roots, "
+                  << (deep ? "depth " : "children ") << branch - (deep ? 0 : 1) << std::endl;
+        std::cout << "    full scalar: " << scalar << " ms" << std::endl;
+        std::cout << "    full simd:   " << full << " ms" << std::endl;
+        std::cout << "    1% dirty:    " << dirty << " ms, " << updated << " nodes recomputed" << std::endl;
+    }
+}
+
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args)
+{
+    if (name == "cull")
+        benchmarkCulling();
+    else if (name == "bvh")
+        benchmarkBvh();
+    else if (name == "png")
+        benchmarkPng(args);
+    else if (name == "jobs")
+        benchmarkJobs(args);
+    else if (name == "entities")
+        benchmarkEntities(args);
+    else if (name == "hierarchy")
+        benchmarkHierarchy(args);
+    else {
+        std::cout << "Unknown benchmark: " << name << std::endl;
+        return false;
+    }
+    
+    return true;
+}
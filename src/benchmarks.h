@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPU micro-benchmarks that don't need a GL context, run with --bench <name> [args...]
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args = {});
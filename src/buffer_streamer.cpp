@@ -0,0 +1,126 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "buffer_streamer.h"
+#include "trace.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool BufferStreamer::create(GLsizeiptr size)
+{
+    chunkSize = size;
+    chunk = 0;
+    bytes = totalSeconds = copySeconds = waitSeconds = 0.0;
+    
+    if (!GLAD_GL_VERSION_4_4)
+        return true;
+    
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &staging);
+    glBindBuffer(GL_COPY_READ_BUFFER, staging);
+    glBufferStorage(GL_COPY_READ_BUFFER, chunkSize * CHUNKS, NULL, flags);
+    mapped = (unsigned char*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, chunkSize * CHUNKS, flags);
+    if (!mapped) {
+        std::cout << "ERROR::BUFFER_STREAMER::MAP_FAILED" << std::endl;
+        destroy();
+        return false;
+    }
+    
+    return true;
+}
+
+void BufferStreamer::destroy()
+{
+    for (GLsync &sync : fences) {
+        glDeleteSync(sync);
+        sync = 0;
+    }
+    
+    if (mapped) {
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        mapped = nullptr;
+    }
+    
+    glDeleteBuffers(1, &staging);
+    staging = 0;
+}
+
+void BufferStreamer::wait(GLsync &sync)
+{
+    if (!sync)
+        return;
+    
+    Clock::time_point waitStart = Clock::now();
+    while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        ;
+    glDeleteSync(sync);
+    sync = 0;
+    waitSeconds += seconds(waitStart);
+}
+
+bool BufferStreamer::upload(GLuint buffer, const void *data, GLsizeiptr size)
+{
+    TRACE_SCOPE("stream buffer");
+    Clock::time_point start = Clock::now();
+    
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    
+    if (!mapped) {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_STATIC_DRAW);
+    } else {
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        
+        const unsigned char *source = (const unsigned char*) data;
+        for (GLsizeiptr offset = 0; offset < size; offset += chunkSize) {
+            GLsizeiptr length = size - offset < chunkSize ? size - offset : chunkSize;
+            
+            wait(fences[chunk]);
+            
+            Clock::time_point copyStart = Clock::now();
+            memcpy(mapped + chunk * chunkSize, source + offset, length);
+            copySeconds += seconds(copyStart);
+            
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, chunk * chunkSize, offset, length);
+            fences[chunk] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            chunk = (chunk + 1) % CHUNKS;
+        }
+    }
+    
+    // the copies are only queued so far, count them in the time too
+    if (mapped) {
+        for (GLsync &sync : fences)
+            wait(sync);
+    } else {
+        glFinish();
+    }
+    
+    bytes += size;
+    totalSeconds += seconds(start);
+    return glGetError() == GL_NO_ERROR;
+}
+
+// MB/s, 0 when nothing was timed
+static double rate(double bytes, double seconds)
+{
+    return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+void BufferStreamer::report() const
+{
+    const double mb = 1024.0 * 1024.0;
+    std::cout << "Streamed " << bytes / mb << " MB in " << totalSeconds * 1000.0 << " ms, "
+              << rate(bytes, totalSeconds) << " MB/s";
+    if (mapped) {
+        std::cout << " (source reads " << rate(bytes, copySeconds) << " MB/s, "
+                  << waitSeconds * 1000.0 << " ms waiting on the gpu)";
+    }
+    std::cout << std::endl;
+}
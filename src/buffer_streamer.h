@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glad.h>
+
+// Uploads large ranges, typically straight out of a mapped file, into
+// immutable gpu buffers. Data goes through a persistently mapped staging
+// ring of CHUNKS slices and glCopyBufferSubData, so there is exactly one
+// cpu copy and the cpu only waits when it laps the gpu, and at the end of
+// an upload until its last copies are done, so the timings cover them.
+// Without GL 4.4 the source is handed to glBufferData directly.
+class BufferStreamer
+{
+public:
+    static const unsigned int CHUNKS = 4;
+    
+    bool create(GLsizeiptr chunkSize = 4 << 20);
+    void destroy();
+    
+    // allocates buffer's storage and fills it with size bytes of data
+    bool upload(GLuint buffer, const void *data, GLsizeiptr size);
+    
+    // totals since create(), to see whether loading is bound by reading the source or by the gpu copies
+    void report() const;
+
+private:
+    void wait(GLsync &sync);
+    
+    GLuint staging = 0;
+    GLsizeiptr chunkSize = 0;
+    unsigned char *mapped = nullptr;
+    GLsync fences[CHUNKS] = {};
+    unsigned int chunk = 0;
+    
+    double bytes = 0.0;
+    double totalSeconds = 0.0;
+    double copySeconds = 0.0;   // memcpy out of the source, includes page faults on a mapped file
+    double waitSeconds = 0.0;   // blocked on the gpu releasing a staging slice or finishing an upload
+};
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "bvh.h"
+
+static const int SAH_BINS = 12;
+static const uint32_t MAX_LEAF_SIZE = 16;
+// traversal keeps at most one pending sibling per level plus the node being
+// split, so stopping the build here keeps the fixed stacks below in bounds
+static const int MAX_DEPTH = 62;
+static const int STACK_SIZE = MAX_DEPTH + 2;
+
+static void grow(Aabb &box, const Aabb &other)
+{
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static float area(const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 e = max - min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+static const Aabb EMPTY_BOX = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+
+void Bvh::build(const std::vector<Aabb> &bounds)
+{
+    uint32_t count = bounds.size();
+    
+    nodes.clear();
+    items.resize(count);
+    itemBounds.resize(count);
+    if (!count)
+        return;
+    
+    std::vector<glm::vec3> centroids(count);
+    for (uint32_t i = 0; i < count; i++) {
+        items[i] = i;
+        centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+    }
+    
+    // root, then an unused slot so every sibling pair starts at an even index
+    nodes.reserve(2 * count + 2);
+    nodes.resize(2);
+    nodes[0].leftFirst = 0;
+    nodes[0].count = count;
+    nodes[1].leftFirst = 0;
+    nodes[1].count = 0;
+    
+    itemBounds = bounds;
+    subdivide(0, 0, centroids);
+    
+    refit(bounds);
+}
+
+void Bvh::subdivide(uint32_t node, int depth, const std::vector<glm::vec3> &centroids)
+{
+    uint32_t first = nodes[node].leftFirst;
+    uint32_t count = nodes[node].count;
+    
+    Aabb box = EMPTY_BOX;
+    Aabb centroidBox = EMPTY_BOX;
+    for (uint32_t i = first; i < first + count; i++) {
+        grow(box, itemBounds[items[i]]);
+        grow(centroidBox, { centroids[items[i]], centroids[items[i]] });
+    }
+    
+    // degenerate input can't be split forever, whatever is left becomes one leaf
+    if (count <= 2 || depth >= MAX_DEPTH)
+        return;
+    
+    // binned SAH over all three axes
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = FLT_MAX;
+    
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = centroidBox.min[axis];
+        float extent = centroidBox.max[axis] - lo;
+        if (extent <= 0.0f)
+            continue;
+        
+        Aabb binBox[SAH_BINS];
+        uint32_t binCount[SAH_BINS] = {};
+        std::fill(binBox, binBox + SAH_BINS, EMPTY_BOX);
+        
+        float scale = SAH_BINS / extent;
+        for (uint32_t i = first; i < first + count; i++) {
+            int bin = std::min(SAH_BINS - 1, (int) ((centroids[items[i]][axis] - lo) * scale));
+            binCount[bin]++;
+            grow(binBox[bin], itemBounds[items[i]]);
+        }
+        
+        // sweep from the right storing areas, then from the left evaluating each split
+        float rightArea[SAH_BINS];
+        uint32_t rightCount[SAH_BINS];
+        Aabb right = EMPTY_BOX;
+        uint32_t n = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--) {
+            grow(right, binBox[b]);
+            n += binCount[b];
+            rightArea[b] = n ? area(right.min, right.max) : 0.0f;
+            rightCount[b] = n;
+        }
+        
+        Aabb left = EMPTY_BOX;
+        n = 0;
+        for (int b = 0; b < SAH_BINS - 1; b++) {
+            grow(left, binBox[b]);
+            n += binCount[b];
+            if (!n || !rightCount[b + 1])
+                continue;
+            float cost = n * area(left.min, left.max) + rightCount[b + 1] * rightArea[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b + 1;
+            }
+        }
+    }
+    
+    float leafCost = count * area(box.min, box.max);
+    if (bestAxis < 0 || (bestCost >= leafCost && count <= MAX_LEAF_SIZE))
+        return;
+    
+    float lo = centroidBox.min[bestAxis];
+    float scale = SAH_BINS / (centroidBox.max[bestAxis] - lo);
+    uint32_t *mid = std::partition(&items[first], &items[first] + count, [&](uint32_t item) {
+        return std::min(SAH_BINS - 1, (int) ((centroids[item][bestAxis] - lo) * scale)) < bestSplit;
+    });
+    uint32_t leftCount = mid - &items[first];
+    
+    uint32_t left = nodes.size();
+    nodes.resize(left + 2);
+    nodes[left].leftFirst = first;
+    nodes[left].count = leftCount;
+    nodes[left + 1].leftFirst = first + leftCount;
+    nodes[left + 1].count = count - leftCount;
+    nodes[node].leftFirst = left;
+    nodes[node].count = 0;
+    
+    subdivide(left, depth + 1, centroids);
+    subdivide(left + 1, depth + 1, centroids);
+}
+
+void Bvh::refit(const std::vector<Aabb> &bounds)
+{
+    for (size_t i = 0; i < items.size(); i++)
+        itemBounds[i] = bounds[items[i]];
+    
+    // children always come after their parent, so walk back to front
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (i == 1)
+            continue;
+        
+        BvhNode &node = nodes[i];
+        Aabb box = EMPTY_BOX;
+        if (node.count) {
+            for (uint32_t j = node.leftFirst; j < node.leftFirst + node.count; j++)
+                grow(box, itemBounds[j]);
+        } else {
+            const BvhNode &left = nodes[node.leftFirst];
+            const BvhNode &right = nodes[node.leftFirst + 1];
+            box.min = glm::min(left.min, right.min);
+            box.max = glm::max(left.max, right.max);
+        }
+        node.min = box.min;
+        node.max = box.max;
+    }
+}
+
+enum Containment { OUTSIDE, INTERSECTS, INSIDE };
+
+static Containment classify(const Frustum &frustum, const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+    
+    Containment result = INSIDE;
+    for (const glm::vec4 &p : frustum.planes) {
+        float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        float radius = std::fabs(p.x) * extent.x + std::fabs(p.y) * extent.y + std::fabs(p.z) * extent.z;
+        if (distance + radius < 0.0f)
+            return OUTSIDE;
+        if (distance - radius < 0.0f)
+            result = INTERSECTS;
+    }
+    return result;
+}
+
+void Bvh::collect(uint32_t node, std::vector<uint32_t> &visible) const
+{
+    const BvhNode &n = nodes[node];
+    if (n.count) {
+        visible.insert(visible.end(), &items[n.leftFirst], &items[n.leftFirst] + n.count);
+    } else {
+        collect(n.leftFirst, visible);
+        collect(n.leftFirst + 1, visible);
+    }
+}
+
+void Bvh::cull(const Frustum &frustum, std::vector<uint32_t> &visible) const
+{
+    if (nodes.empty())
+        return;
+    
+    uint32_t stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    
+    while (top) {
+        const BvhNode &node = nodes[stack[--top]];
+        
+        Containment c = classify(frustum, node.min, node.max);
+        if (c == OUTSIDE)
+            continue;
+        if (c == INSIDE) {
+            collect(&node - nodes.data(), visible);
+            continue;
+        }
+        
+        if (node.count) {
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                if (classify(frustum, itemBounds[i].min, itemBounds[i].max) != OUTSIDE)
+                    visible.push_back(items[i]);
+            }
+        } else {
+            stack[top++] = node.leftFirst;
+            stack[top++] = node.leftFirst + 1;
+        }
+    }
+}
+
+// slab test, entry distance or FLT_MAX on a miss
+static float intersectRay(
+    const glm::vec3 &min,
+    const glm::vec3 &max,
+    const glm::vec3 &origin,
+    const glm::vec3 &invDirection,
+    float tMax)
+{
+    float tNear = 0.0f;
+    float tFar = tMax;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (min[axis] - origin[axis]) * invDirection[axis];
+        float t1 = (max[axis] - origin[axis]) * invDirection[axis];
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    return tNear <= tFar ? tNear : FLT_MAX;
+}
+
+int Bvh::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance) const
+{
+    if (nodes.empty())
+        return -1;
+    
+    glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    int hit = -1;
+    distance = FLT_MAX;
+    
+    // nodes go on the stack with their entry distance, one entered beyond
+    // the best hit found since it was pushed is skipped when popped
+    struct Entry
+    {
+        uint32_t node;
+        float t;
+    };
+    Entry stack[STACK_SIZE];
+    int top = 0;
+    float tRoot = intersectRay(nodes[0].min, nodes[0].max, origin, invDirection, distance);
+    if (tRoot != FLT_MAX)
+        stack[top++] = { 0, tRoot };
+    
+    while (top) {
+        Entry entry = stack[--top];
+        if (entry.t >= distance)
+            continue;
+        const BvhNode &node = nodes[entry.node];
+        
+        if (node.count) {
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                float t = intersectRay(itemBounds[i].min, itemBounds[i].max, origin, invDirection, distance);
+                if (t < distance) {
+                    distance = t;
+                    hit = items[i];
+                }
+            }
+            continue;
+        }
+        
+        // push the farther child first so the nearer one is visited next
+        uint32_t closer = node.leftFirst;
+        uint32_t farther = node.leftFirst + 1;
+        float tCloser = intersectRay(nodes[closer].min, nodes[closer].max, origin, invDirection, distance);
+        float tFarther = intersectRay(nodes[farther].min, nodes[farther].max, origin, invDirection, distance);
+        if (tFarther < tCloser) {
+            std::swap(closer, farther);
+            std::swap(tCloser, tFarther);
+        }
+        if (tFarther != FLT_MAX)
+            stack[top++] = { farther, tFarther };
+        if (tCloser != FLT_MAX)
+            stack[top++] = { closer, tCloser };
+    }
+    
+    return hit;
+}
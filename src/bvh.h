@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "frustum.h"
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// 32 bytes. Children are allocated as pairs starting at an even index, so
+// with the array aligned to 64 bytes both siblings share one cache line.
+struct alignas(32) BvhNode
+{
+    glm::vec3 min;
+    uint32_t leftFirst;     // left child for inner nodes, first item for leaves
+    glm::vec3 max;
+    uint32_t count;         // items in a leaf, 0 for inner nodes
+};
+
+template <typename T>
+struct CacheLineAllocator
+{
+    typedef T value_type;
+    
+    CacheLineAllocator() {}
+    template <typename U> CacheLineAllocator(const CacheLineAllocator<U>&) {}
+    
+    T* allocate(size_t n) { return (T*) ::operator new(n * sizeof(T), std::align_val_t(64)); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(64)); }
+    
+    template <typename U> bool operator==(const CacheLineAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const CacheLineAllocator<U>&) const { return false; }
+};
+
+// Bounding volume hierarchy over object boxes, built with binned SAH.
+// Objects that move keep their place in the tree, refit() only grows or
+// shrinks the node boxes, rebuild once the tree quality has degraded.
+class Bvh
+{
+public:
+    void build(const std::vector<Aabb> &bounds);
+    void refit(const std::vector<Aabb> &bounds);
+    
+    // appends visible object indices, boxes fully inside skip the plane tests
+    void cull(const Frustum &frustum, std::vector<uint32_t> &visible) const;
+    // nearest object whose box the ray hits, -1 if none
+    int raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance) const;
+    
+    size_t nodeCount() const { return nodes.size(); }
+
+private:
+    void subdivide(uint32_t node, int depth, const std::vector<glm::vec3> &centroids);
+    void collect(uint32_t node, std::vector<uint32_t> &visible) const;
+    
+    std::vector<BvhNode, CacheLineAllocator<BvhNode>> nodes;
+    std::vector<uint32_t> items;    // object indices in leaf order
+    std::vector<Aabb> itemBounds;   // boxes in the same order as items
+};
@@ -0,0 +1,176 @@
+#include <cmath>
+#include <iostream>
+
+#include "entity_store.h"
+
+Entity EntityStore::create(const EntityDesc &desc)
+{
+    uint32_t parentNode = alive(desc.parent) ? node[sparse[desc.parent & INDEX_MASK]] : TransformHierarchy::NO_PARENT;
+    
+    uint32_t index;
+    if (!freeIndices.empty()) {
+        index = freeIndices.back();
+        freeIndices.pop_back();
+    } else {
+        // the top index with the top generation would read as NULL_ENTITY
+        if (sparse.size() >= INDEX_MASK) {
+            std::cout << "ERROR::ENTITY_STORE::OUT_OF_HANDLES" << std::endl;
+            return NULL_ENTITY;
+        }
+        index = (uint32_t) sparse.size();
+        sparse.push_back(INVALID_SLOT);
+        generations.push_back(0);
+    }
+    
+    Entity entity = (uint32_t) generations[index] << 24 | index;
+    uint32_t slot = (uint32_t) entities.size();
+    sparse[index] = slot;
+    
+    glm::vec3 axis = glm::normalize(desc.axis);
+    entities.push_back(entity);
+    px.push_back(desc.position.x);
+    py.push_back(desc.position.y);
+    pz.push_back(desc.position.z);
+    ax.push_back(axis.x);
+    ay.push_back(axis.y);
+    az.push_back(axis.z);
+    spin.push_back(desc.spin);
+    scale.push_back(desc.scale);
+    node.push_back(hierarchy.add(parentNode, localMatrix(slot, 0.0f)));
+    bounds.resize(slot + 1);
+    bounds.set(slot, desc.position, glm::vec3(0.8660254f * desc.scale));
+    mesh.push_back(desc.mesh);
+    material.push_back(desc.material);
+    
+    return entity;
+}
+
+template <typename T>
+static void moveLast(std::vector<T> &v, uint32_t slot)
+{
+    v[slot] = v.back();
+    v.pop_back();
+}
+
+void EntityStore::destroy(Entity entity)
+{
+    if (!alive(entity))
+        return;
+    
+    uint32_t index = entity & INDEX_MASK;
+    uint32_t slot = sparse[index];
+    uint32_t last = (uint32_t) entities.size() - 1;
+    
+    // children become roots, their position then counts from the origin
+    hierarchy.remove(node[slot]);
+    
+    // the last entity takes over the freed slot
+    sparse[entities[last] & INDEX_MASK] = slot;
+    moveLast(entities, slot);
+    moveLast(px, slot);
+    moveLast(py, slot);
+    moveLast(pz, slot);
+    moveLast(ax, slot);
+    moveLast(ay, slot);
+    moveLast(az, slot);
+    moveLast(spin, slot);
+    moveLast(scale, slot);
+    moveLast(node, slot);
+    moveLast(mesh, slot);
+    moveLast(material, slot);
+    bounds.set(slot, glm::vec3(bounds.cx[last], bounds.cy[last], bounds.cz[last]),
+               glm::vec3(bounds.ex[last], bounds.ey[last], bounds.ez[last]));
+    bounds.resize(last);
+    
+    // an index that went through every generation is retired rather than
+    // wrapping back to 0, where old handles to it would look alive again
+    sparse[index] = INVALID_SLOT;
+    if (generations[index] != MAX_GENERATION) {
+        generations[index]++;
+        freeIndices.push_back(index);
+    }
+    slotsMoved = true;
+}
+
+void EntityStore::reserve(size_t count)
+{
+    entities.reserve(count);
+    for (std::vector<float> *v : { &px, &py, &pz, &ax, &ay, &az, &spin, &scale })
+        v->reserve(count);
+    node.reserve(count);
+    mesh.reserve(count);
+    material.reserve(count);
+    sparse.reserve(count);
+    generations.reserve(count);
+}
+
+void EntityStore::clear()
+{
+    *this = EntityStore();
+}
+
+bool EntityStore::alive(Entity entity) const
+{
+    uint32_t index = entity & INDEX_MASK;
+    return entity != NULL_ENTITY && index < sparse.size() && sparse[index] != INVALID_SLOT
+        && generations[index] == entity >> 24;
+}
+
+// rotation about the unit axis (Rodrigues), then scale, then translation
+glm::mat4 EntityStore::localMatrix(uint32_t i, float time) const
+{
+    float angle = spin[i] * time;
+    float c = std::cos(angle), s = std::sin(angle), t = 1.0f - c;
+    float x = ax[i], y = ay[i], z = az[i], k = scale[i];
+    
+    glm::mat4 m;
+    m[0][0] = (t * x * x + c) * k;
+    m[0][1] = (t * x * y + s * z) * k;
+    m[0][2] = (t * x * z - s * y) * k;
+    m[0][3] = 0.0f;
+    m[1][0] = (t * x * y - s * z) * k;
+    m[1][1] = (t * y * y + c) * k;
+    m[1][2] = (t * y * z + s * x) * k;
+    m[1][3] = 0.0f;
+    m[2][0] = (t * x * z + s * y) * k;
+    m[2][1] = (t * y * z - s * x) * k;
+    m[2][2] = (t * z * z + c) * k;
+    m[2][3] = 0.0f;
+    m[3][0] = px[i];
+    m[3][1] = py[i];
+    m[3][2] = pz[i];
+    m[3][3] = 1.0f;
+    return m;
+}
+
+void EntityStore::updateLocals(uint32_t begin, uint32_t end, float time)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        // the rest keep the matrix they were created with
+        if (spin[i] != 0.0f)
+            hierarchy.setLocal(node[i], localMatrix(i, time));
+    }
+}
+
+size_t EntityStore::updateWorlds()
+{
+    if (slotsMoved) {
+        hierarchy.setRootOrder(node);
+        slotsMoved = false;
+    }
+    return hierarchy.update();
+}
+
+void EntityStore::updateBounds(uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        // exact box of the transformed unit cube
+        const glm::mat4 &m = world(i);
+        bounds.cx[i] = m[3][0];
+        bounds.cy[i] = m[3][1];
+        bounds.cz[i] = m[3][2];
+        bounds.ex[i] = 0.5f * (std::fabs(m[0][0]) + std::fabs(m[1][0]) + std::fabs(m[2][0]));
+        bounds.ey[i] = 0.5f * (std::fabs(m[0][1]) + std::fabs(m[1][1]) + std::fabs(m[2][1]));
+        bounds.ez[i] = 0.5f * (std::fabs(m[0][2]) + std::fabs(m[1][2]) + std::fabs(m[2][2]));
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "frustum.h"
+#include "transform_hierarchy.h"
+
+// Handle to an entity: slot in the sparse array in the low 24 bits, a
+// generation in the high 8 so handles to destroyed entities go stale. A
+// store hands out at most 2^24 - 1 indices and retires one after its 256th
+// entity, once they run out create() returns NULL_ENTITY.
+typedef uint32_t Entity;
+const Entity NULL_ENTITY = ~0u;
+
+struct EntityDesc
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);  // spin axis, normalized by create()
+    float spin = 0.0f;          // radians per second
+    float scale = 1.0f;
+    uint16_t mesh = 0;
+    uint16_t material = 0;
+    Entity parent = NULL_ENTITY;    // moves along with the parent, position is relative to it
+};
+
+// Entities with their components in parallel arrays (structure of arrays)
+// indexed by a dense slot. A sparse set maps handles to slots; destroying
+// an entity moves the last one into its slot, so the live entities are
+// always the first size() of every array and systems stream through them
+// front to back, or split them into ranges for the job system. World
+// matrices live in a transform hierarchy, so entities that don't move
+// and aren't below one that does are never recomputed.
+class EntityStore
+{
+public:
+    Entity create(const EntityDesc &desc);
+    void destroy(Entity entity);
+    void reserve(size_t count);
+    void clear();
+    
+    bool alive(Entity entity) const;
+    uint32_t slot(Entity entity) const { return sparse[entity & INDEX_MASK]; }
+    size_t size() const { return entities.size(); }
+    
+    // transform system in three passes: local matrices of the spinning
+    // entities in [begin, end) at the given time, then the world matrices of
+    // whatever changed, then the boxes of [begin, end) around a unit cube
+    // under the world matrix. The ranged passes can run as parallel jobs.
+    void updateLocals(uint32_t begin, uint32_t end, float time);
+    size_t updateWorlds();
+    void updateBounds(uint32_t begin, uint32_t end);
+    
+    const glm::mat4& world(uint32_t slot) const { return hierarchy.world(node[slot]); }
+    
+    // components, indexed by slot
+    std::vector<Entity> entities;
+    std::vector<float> px, py, pz;          // position
+    std::vector<float> ax, ay, az, spin;    // rotation, the angle at time t is spin * t
+    std::vector<float> scale;
+    std::vector<uint32_t> node;             // in the hierarchy
+    BoundsSoA bounds;
+    std::vector<uint16_t> mesh;
+    std::vector<uint16_t> material;
+
+private:
+    glm::mat4 localMatrix(uint32_t slot, float time) const;
+    
+    TransformHierarchy hierarchy;
+    bool slotsMoved = false;    // destroy() reordered the slots, the hierarchy should follow
+    
+    static constexpr uint32_t INDEX_MASK = 0xffffff;
+    static constexpr uint8_t MAX_GENERATION = 0xff;
+    static constexpr uint32_t INVALID_SLOT = ~0u;
+    
+    std::vector<uint32_t> sparse;           // handle index -> slot
+    std::vector<uint8_t> generations;       // per handle index, bumped on destroy
+    std::vector<uint32_t> freeIndices;
+};
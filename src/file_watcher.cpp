@@ -0,0 +1,108 @@
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "file_watcher.h"
+
+#ifdef __linux__
+
+static void splitPath(const std::string &path, std::string &directory, std::string &name)
+{
+    size_t slash = path.find_last_of("/\\");
+    directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool FileWatcher::create()
+{
+    destroy();
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return fd >= 0;
+}
+
+void FileWatcher::destroy()
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    directories.clear();
+}
+
+bool FileWatcher::watch(const std::string &path)
+{
+    if (fd < 0)
+        return false;
+    
+    std::string directory, name;
+    splitPath(path, directory, name);
+    
+    auto it = std::find_if(directories.begin(), directories.end(),
+                           [&](const Directory &d) { return d.path == directory; });
+    if (it == directories.end()) {
+        int descriptor = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (descriptor < 0)
+            return false;
+        directories.push_back({ descriptor, directory, {} });
+        it = directories.end() - 1;
+    }
+    
+    if (std::find(it->names.begin(), it->names.end(), name) == it->names.end())
+        it->names.push_back(name);
+    return true;
+}
+
+bool FileWatcher::poll()
+{
+    if (fd < 0)
+        return false;
+    
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+    
+    for (;;) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;  // EAGAIN, nothing more queued
+        
+        for (char *p = buffer; p < buffer + length; ) {
+            const inotify_event *event = (const inotify_event*) p;
+            p += sizeof(inotify_event) + event->len;
+            if (!event->len)
+                continue;
+            
+            for (const Directory &directory : directories) {
+                if (directory.descriptor == event->wd
+                    && std::find(directory.names.begin(), directory.names.end(), event->name) != directory.names.end())
+                    changed = true;
+            }
+        }
+    }
+    
+    return changed;
+}
+
+#else
+
+bool FileWatcher::create()
+{
+    return false;
+}
+
+void FileWatcher::destroy()
+{
+}
+
+bool FileWatcher::watch(const std::string &path)
+{
+    return false;
+}
+
+bool FileWatcher::poll()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Change notifications for a set of files through inotify. The parent
+// directories are watched rather than the files, editors that save by
+// writing a new file and renaming it over the old one would otherwise
+// detach the watch. poll() is a single non-blocking read, no timestamps
+// are compared. Without inotify nothing is ever reported changed.
+class FileWatcher
+{
+public:
+    FileWatcher() {}
+    ~FileWatcher() { destroy(); }
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    
+    bool create();
+    void destroy();
+    
+    bool watch(const std::string &path);
+    
+    // true if a watched file was written or replaced since the last poll
+    bool poll();
+
+private:
+    struct Directory
+    {
+        int descriptor;
+        std::string path;
+        std::vector<std::string> names;     // watched files in it
+    };
+    
+    int fd = -1;
+    std::vector<Directory> directories;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer handing whole frames from one producer thread to
+// one consumer thread. The producer fills back() and publish()es it, the
+// consumer acquire()s the newest published frame and reads it through
+// front(). The slot in the middle changes hands with a single atomic
+// exchange, so neither side ever blocks on the other. A frame published
+// before the previous one was taken replaces it.
+template <typename T>
+class FrameMailbox
+{
+public:
+    // producer side
+    T& back() { return slots[backIndex]; }
+    void publish()
+    {
+        uint8_t previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        backIndex = previous & INDEX;
+    }
+    
+    // published but not taken yet, the producer can hold off on the next one
+    bool pending() const { return middle.load(std::memory_order_acquire) & FRESH; }
+    
+    // consumer side, false if nothing newer than front() was published
+    bool acquire()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        
+        // only we clear FRESH, the producer may have swapped in an even newer frame meanwhile
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const uint8_t INDEX = 3;
+    static const uint8_t FRESH = 4;
+    
+    T slots[3];
+    uint8_t backIndex = 0;      // producer only
+    uint8_t frontIndex = 1;     // consumer only
+    alignas(64) std::atomic<uint8_t> middle { 2 };
+};
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "frame_profiler.h"
+
+const char* stageName(FrameStage stage)
+{
+    static const char *names[STAGE_COUNT] = { "input", "clear", "transform", "draw", "swap" };
+    return names[stage];
+}
+
+void FrameProfiler::Samples::add(double value)
+{
+    values[next] = value;
+    next = (next + 1) % WINDOW;
+    count = std::min(count + 1, WINDOW);
+}
+
+StageStats FrameProfiler::Samples::stats() const
+{
+    StageStats result = { 0.0, 0.0, 0.0 };
+    if (!count)
+        return result;
+    
+    double sorted[WINDOW];
+    std::copy(values, values + count, sorted);
+    
+    unsigned int p99 = std::min(count - 1, count * 99 / 100);
+    std::nth_element(sorted, sorted + p99, sorted + count);
+    result.p99 = sorted[p99];
+    
+    result.min = *std::min_element(values, values + count);
+    for (unsigned int i = 0; i < count; i++)
+        result.avg += values[i];
+    result.avg /= count;
+    
+    return result;
+}
+
+bool FrameProfiler::init()
+{
+    glGenQueries(QUERY_FRAMES * STAGE_COUNT, &queries[0][0]);
+    return glGetError() == GL_NO_ERROR;
+}
+
+void FrameProfiler::destroy()
+{
+    glDeleteQueries(QUERY_FRAMES * STAGE_COUNT, &queries[0][0]);
+}
+
+void FrameProfiler::reset()
+{
+    for (unsigned int i = 0; i < STAGE_COUNT; i++) {
+        cpu[i] = Samples();
+        gpu[i] = Samples();
+    }
+    frame = Samples();
+    lateQueries = 0;
+}
+
+void FrameProfiler::beginFrame()
+{
+    frameStart = Clock::now();
+    
+    // collect the oldest query set before it's reused. A result that isn't
+    // there yet is waited for, dropping it would leave out exactly the frames
+    // where the gpu fell behind; those waits are counted for the log
+    for (unsigned int stage = 0; stage < STAGE_COUNT; stage++) {
+        if (!pending[queryFrame][stage])
+            continue;
+        
+        GLuint query = queries[queryFrame][stage];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            lateQueries++;
+        
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        gpu[stage].add(ns / 1000000.0);
+        pending[queryFrame][stage] = false;
+    }
+}
+
+void FrameProfiler::endFrame()
+{
+    frame.add(std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+    queryFrame = (queryFrame + 1) % QUERY_FRAMES;
+}
+
+void FrameProfiler::begin(FrameStage stage)
+{
+    stageStart[stage] = Clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, queries[queryFrame][stage]);
+}
+
+void FrameProfiler::end(FrameStage stage)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[queryFrame][stage] = true;
+    cpu[stage].add(std::chrono::duration<double, std::milli>(Clock::now() - stageStart[stage]).count());
+}
+
+StageStats FrameProfiler::cpuStats(FrameStage stage) const
+{
+    return cpu[stage].stats();
+}
+
+StageStats FrameProfiler::gpuStats(FrameStage stage) const
+{
+    return gpu[stage].stats();
+}
+
+StageStats FrameProfiler::frameStats() const
+{
+    return frame.stats();
+}
+
+void FrameProfiler::log() const
+{
+    std::ios::fmtflags flags = std::cout.flags();
+    std::cout << std::fixed << std::setprecision(3);
+    
+    StageStats total = frameStats();
+    std::cout << "frame (ms)      min/avg/p99 " << total.min << " / " << total.avg << " / " << total.p99 << std::endl;
+    
+    for (unsigned int i = 0; i < STAGE_COUNT; i++) {
+        StageStats c = cpuStats((FrameStage) i);
+        StageStats g = gpuStats((FrameStage) i);
+        std::cout << "  " << std::left << std::setw(10) << stageName((FrameStage) i) << std::right
+                  << " cpu " << c.min << " / " << c.avg << " / " << c.p99
+                  << "   gpu " << g.min << " / " << g.avg << " / " << g.p99 << std::endl;
+    }
+    if (lateQueries)
+        std::cout << "  " << lateQueries << " gpu results waited for, the gpu ran more than "
+                  << QUERY_FRAMES << " frames behind" << std::endl;
+    
+    std::cout.flags(flags);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <glad.h>
+
+enum FrameStage
+{
+    STAGE_INPUT,
+    STAGE_CLEAR,
+    STAGE_TRANSFORM,
+    STAGE_DRAW,
+    STAGE_SWAP,
+    STAGE_COUNT
+};
+
+struct StageStats
+{
+    double min;     // all in milliseconds over the rolling window
+    double avg;
+    double p99;
+};
+
+// Per-stage cpu and gpu timings over the last WINDOW frames. Cpu times come
+// from steady_clock, gpu times from GL_TIME_ELAPSED queries that are read
+// back QUERY_FRAMES frames later so fetching a result rarely waits on the
+// gpu; when it does, the wait is counted in the log. Stages must not
+// overlap, only one elapsed-time query can be active.
+class FrameProfiler
+{
+public:
+    static const unsigned int WINDOW = 256;
+    static const unsigned int QUERY_FRAMES = 2;
+    
+    bool init();
+    void destroy();
+    void reset();   // drops collected samples, queries in flight still land
+    
+    void beginFrame();
+    void endFrame();
+    void begin(FrameStage stage);
+    void end(FrameStage stage);
+    
+    StageStats cpuStats(FrameStage stage) const;
+    StageStats gpuStats(FrameStage stage) const;
+    StageStats frameStats() const;
+    
+    void log() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    struct Samples
+    {
+        double values[WINDOW] = {};
+        unsigned int count = 0;
+        unsigned int next = 0;
+        
+        void add(double value);
+        StageStats stats() const;
+    };
+    
+    Samples cpu[STAGE_COUNT];
+    Samples gpu[STAGE_COUNT];
+    Samples frame;
+    
+    Clock::time_point frameStart;
+    Clock::time_point stageStart[STAGE_COUNT];
+    
+    GLuint queries[QUERY_FRAMES][STAGE_COUNT] = {};
+    bool pending[QUERY_FRAMES][STAGE_COUNT] = {};
+    unsigned int queryFrame = 0;
+    unsigned int lateQueries = 0;   // results beginFrame() had to wait for
+};
+
+class ProfileScope
+{
+public:
+    ProfileScope(FrameProfiler &profiler, FrameStage stage) : profiler(profiler), stage(stage)
+    {
+        profiler.begin(stage);
+    }
+    ~ProfileScope()
+    {
+        profiler.end(stage);
+    }
+
+private:
+    FrameProfiler &profiler;
+    FrameStage stage;
+};
+
+const char* stageName(FrameStage stage);
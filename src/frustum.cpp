@@ -0,0 +1,193 @@
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+#include "frustum.h"
+
+Frustum extractFrustum(const glm::mat4 &m)
+{
+    // Gribb/Hartmann, rows of the column-major matrix
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];    // left
+    frustum.planes[1] = row[3] - row[0];    // right
+    frustum.planes[2] = row[3] + row[1];    // bottom
+    frustum.planes[3] = row[3] - row[1];    // top
+    frustum.planes[4] = row[3] + row[2];    // near
+    frustum.planes[5] = row[3] - row[2];    // far
+    
+    for (glm::vec4 &plane : frustum.planes) {
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        plane = plane * (1.0f / length);
+    }
+    
+    return frustum;
+}
+
+void BoundsSoA::resize(size_t size)
+{
+    count = size;
+    size_t padded = (size + 7) & ~size_t(7);
+    for (std::vector<float> *v : { &cx, &cy, &cz, &ex, &ey, &ez })
+        v->resize(padded, 0.0f);
+}
+
+size_t cullBoundsScalar(const Frustum &frustum, const BoundsSoA &bounds, std::vector<uint32_t> &visible)
+{
+    return cullBoundsScalar(frustum, bounds, 0, bounds.count, visible);
+}
+
+size_t cullBoundsScalar(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible)
+{
+    size_t first = visible.size();
+    
+    for (size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for (const glm::vec4 &p : frustum.planes) {
+            // box is outside if even its most positive corner is behind the plane
+            float distance = p.x * bounds.cx[i] + p.y * bounds.cy[i] + p.z * bounds.cz[i] + p.w;
+            float radius = std::fabs(p.x) * bounds.ex[i] + std::fabs(p.y) * bounds.ey[i] + std::fabs(p.z) * bounds.ez[i];
+            if (distance + radius < 0.0f) {
+                inside = false;
+                break;
+            }
+        }
+        if (inside)
+            visible.push_back(i);
+    }
+    
+    return visible.size() - first;
+}
+
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, std::vector<uint32_t> &visible)
+{
+    return cullBounds(frustum, bounds, 0, bounds.count, visible);
+}
+
+#if defined(__AVX__)
+
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible)
+{
+    size_t first = visible.size();
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    
+    __m256 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+    for (int j = 0; j < 6; j++) {
+        const glm::vec4 &p = frustum.planes[j];
+        px[j] = _mm256_set1_ps(p.x);
+        py[j] = _mm256_set1_ps(p.y);
+        pz[j] = _mm256_set1_ps(p.z);
+        pw[j] = _mm256_set1_ps(p.w);
+        ax[j] = _mm256_andnot_ps(signMask, px[j]);
+        ay[j] = _mm256_andnot_ps(signMask, py[j]);
+        az[j] = _mm256_andnot_ps(signMask, pz[j]);
+    }
+    
+    for (size_t i = begin; i < end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&bounds.cx[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.cy[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.cz[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.ex[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.ey[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.ez[i]);
+        
+        // lanes stay set while distance + radius >= 0 for every plane
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int j = 0; j < 6; j++) {
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[j], cx), _mm256_mul_ps(py[j], cy)),
+                                     _mm256_add_ps(_mm256_mul_ps(pz[j], cz), pw[j]));
+            __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[j], ex), _mm256_mul_ps(ay[j], ey)),
+                                     _mm256_mul_ps(az[j], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        
+        unsigned int mask = _mm256_movemask_ps(inside);
+        if (end - i < 8)
+            mask &= (1u << (end - i)) - 1;
+        for (unsigned int lane = 0; lane < 8; lane++) {
+            if (mask & (1u << lane))
+                visible.push_back(i + lane);
+        }
+    }
+    
+    return visible.size() - first;
+}
+
+const char* cullBoundsPath()
+{
+    return "avx";
+}
+
+#elif defined(FRUSTUM_SSE)
+
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible)
+{
+    size_t first = visible.size();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    
+    __m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+    for (int j = 0; j < 6; j++) {
+        const glm::vec4 &p = frustum.planes[j];
+        px[j] = _mm_set1_ps(p.x);
+        py[j] = _mm_set1_ps(p.y);
+        pz[j] = _mm_set1_ps(p.z);
+        pw[j] = _mm_set1_ps(p.w);
+        ax[j] = _mm_andnot_ps(signMask, px[j]);
+        ay[j] = _mm_andnot_ps(signMask, py[j]);
+        az[j] = _mm_andnot_ps(signMask, pz[j]);
+    }
+    
+    for (size_t i = begin; i < end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.cx[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.cy[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.cz[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.ex[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.ey[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.ez[i]);
+        
+        // lanes stay set while distance + radius >= 0 for every plane
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int j = 0; j < 6; j++) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[j], cx), _mm_mul_ps(py[j], cy)),
+                                  _mm_add_ps(_mm_mul_ps(pz[j], cz), pw[j]));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[j], ex), _mm_mul_ps(ay[j], ey)),
+                                  _mm_mul_ps(az[j], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        
+        unsigned int mask = _mm_movemask_ps(inside);
+        if (end - i < 4)
+            mask &= (1u << (end - i)) - 1;
+        for (unsigned int lane = 0; lane < 4; lane++) {
+            if (mask & (1u << lane))
+                visible.push_back(i + lane);
+        }
+    }
+    
+    return visible.size() - first;
+}
+
+const char* cullBoundsPath()
+{
+    return "sse2";
+}
+
+#else
+
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible)
+{
+    return cullBoundsScalar(frustum, bounds, begin, end, visible);
+}
+
+const char* cullBoundsPath()
+{
+    return "scalar";
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm.hpp>
+
+// six normalized planes (xyz normal, w distance), a point p is inside
+// all of them when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4 &viewProj);
+
+// Axis aligned boxes as center/half extent arrays so the culling kernels
+// can test 4 or 8 boxes per iteration. Storage is padded to a multiple
+// of 8 boxes, padding is never reported visible.
+struct BoundsSoA
+{
+    std::vector<float> cx, cy, cz;
+    std::vector<float> ex, ey, ez;
+    size_t count = 0;
+    
+    void resize(size_t size);
+    void set(size_t i, const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        cx[i] = center.x; cy[i] = center.y; cz[i] = center.z;
+        ex[i] = extent.x; ey[i] = extent.y; ez[i] = extent.z;
+    }
+};
+
+// Appends the indices of boxes that intersect the frustum to visible and
+// returns how many were added. cullBounds uses the widest SIMD path the
+// build was compiled with (AVX, SSE2 or scalar). The range variants only
+// test boxes [begin, end), begin has to be a multiple of 8 so a worker's
+// chunk starts on a simd boundary.
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, std::vector<uint32_t> &visible);
+size_t cullBounds(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible);
+size_t cullBoundsScalar(const Frustum &frustum, const BoundsSoA &bounds, std::vector<uint32_t> &visible);
+size_t cullBoundsScalar(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, std::vector<uint32_t> &visible);
+const char* cullBoundsPath();
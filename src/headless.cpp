@@ -0,0 +1,186 @@
+#include <cstring>
+#include <iostream>
+
+#include <glad.h>
+
+#ifdef HAVE_EGL
+// keep Xlib and its macros out, nothing here needs a display
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "headless.h"
+#include "program_cache.h"
+#include "shader_loader.h"
+
+#ifdef HAVE_EGL
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+
+static GLuint framebuffer;
+static GLuint color_buffer;
+static GLuint depth_buffer;
+
+static bool hasExtension(const char *extensions, const char *name)
+{
+    if (!extensions)
+        return false;
+    
+    size_t length = strlen(name);
+    for (const char *p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+static EGLDisplay getDisplay()
+{
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    
+    if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            return getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool initHeadless(unsigned int width, unsigned int height)
+{
+    display = getDisplay();
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        std::cout << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
+    
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cout << "EGL has no desktop OpenGL support" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || !configCount) {
+        std::cout << "Failed to choose EGL config" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+        std::cout << "Failed to create EGL context" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    
+    // rendering goes to our own framebuffer, the surface only exists if the driver insists on one
+    if (!hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    }
+    
+    if (!eglMakeCurrent(display, surface, surface, context)) {
+        std::cout << "Failed to make EGL context current" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    loadProgramBinaryExtension((GLADloadproc)eglGetProcAddress);
+    ProgramBatch::init((GLADloadproc)eglGetProcAddress);
+    
+    // === framebuffer ====================================
+    glGenRenderbuffers(1, &color_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    
+    glGenRenderbuffers(1, &depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+    
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << std::endl;
+        destroyHeadless();
+        return false;
+    }
+    
+    // without a surface the default viewport is empty
+    glViewport(0, 0, width, height);
+    
+    return true;
+}
+
+void destroyHeadless()
+{
+    if (context != EGL_NO_CONTEXT && eglGetCurrentContext() == context) {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &depth_buffer);
+        glDeleteRenderbuffers(1, &color_buffer);
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    
+    if (surface != EGL_NO_SURFACE)
+        eglDestroySurface(display, surface);
+    if (context != EGL_NO_CONTEXT)
+        eglDestroyContext(display, context);
+    if (display != EGL_NO_DISPLAY)
+        eglTerminate(display);
+    
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+    display = EGL_NO_DISPLAY;
+}
+
+bool makeHeadlessCurrent(bool current)
+{
+    if (current)
+        return eglMakeCurrent(display, surface, surface, context);
+    return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+#else
+
+bool initHeadless(unsigned int width, unsigned int height)
+{
+    std::cout << "Headless mode needs EGL, rebuild with EGL available" << std::endl;
+    return false;
+}
+
+void destroyHeadless()
+{
+}
+
+bool makeHeadlessCurrent(bool current)
+{
+    return false;
+}
+
+#endif
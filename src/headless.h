@@ -0,0 +1,11 @@
+#pragma once
+
+// Offscreen GL 3.3 core context without a window or display server, so
+// the renderer can run on build machines. Uses surfaceless EGL (Mesa,
+// including llvmpipe) and renders into a framebuffer object of the given
+// size, which stays bound as the draw framebuffer.
+bool initHeadless(unsigned int width, unsigned int height);
+void destroyHeadless();
+
+// binds the context to the calling thread, or releases it so another thread can take it
+bool makeHeadlessCurrent(bool current);
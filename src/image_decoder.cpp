@@ -0,0 +1,391 @@
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define DECODER_SSE
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <stb_image.h>
+
+#include "image_decoder.h"
+#include "mapped_file.h"
+#include "trace.h"
+
+// === png container ==================================
+struct PngImage
+{
+    unsigned int width = 0, height = 0, channels = 0;
+    const unsigned char *compressed = nullptr;  // the IDAT stream, in the mapping when it's one chunk
+    size_t compressedSize = 0;
+    std::vector<unsigned char> joined;          // when it's split over several
+};
+
+static uint32_t readBigEndian(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// false for anything the fast path doesn't handle, stb_image decodes those
+static bool parsePng(const unsigned char *data, size_t size, PngImage &png)
+{
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    if (size < 8 || memcmp(data, signature, 8))
+        return false;
+    
+    std::vector<std::pair<const unsigned char*, size_t>> chunks;
+    for (size_t pos = 8; ; ) {
+        if (pos + 12 > size)
+            return false;
+        size_t length = readBigEndian(data + pos);
+        const unsigned char *type = data + pos + 4;
+        const unsigned char *body = data + pos + 8;
+        if (length > size - pos - 12)
+            return false;
+        
+        if (!memcmp(type, "IHDR", 4)) {
+            if (length != 13)
+                return false;
+            png.width = readBigEndian(body);
+            png.height = readBigEndian(body + 4);
+            int depth = body[8], color = body[9], interlace = body[12];
+            if (depth != 8 || interlace || body[10] || body[11])
+                return false;
+            switch (color) {
+            case 0:  png.channels = 1; break;
+            case 2:  png.channels = 3; break;
+            case 4:  png.channels = 2; break;
+            case 6:  png.channels = 4; break;
+            default: return false;      // palette
+            }
+            if (!png.width || !png.height || png.width > (1u << 24) || png.height > (1u << 24))
+                return false;
+            // the filtered rows and a 4 channel copy have to fit the int sizes zlib and stb work with
+            uint64_t rowBytes = ((uint64_t) png.width * png.channels + 1) * png.height + 4;
+            uint64_t pixelBytes = (uint64_t) png.width * png.height * 4;
+            if (rowBytes > INT_MAX || pixelBytes > INT_MAX)
+                return false;
+        } else if (pos == 8) {
+            return false;               // IHDR has to come first
+        } else if (!memcmp(type, "tRNS", 4)) {
+            return false;               // stb_image turns it into an alpha channel
+        } else if (!memcmp(type, "IDAT", 4)) {
+            chunks.emplace_back(body, length);
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
+        }
+        pos += length + 12;
+    }
+    
+    if (chunks.empty())
+        return false;
+    if (chunks.size() == 1) {
+        png.compressed = chunks[0].first;
+        png.compressedSize = chunks[0].second;
+    } else {
+        for (const auto &chunk : chunks)
+            png.joined.insert(png.joined.end(), chunk.first, chunk.first + chunk.second);
+        png.compressed = png.joined.data();
+        png.compressedSize = png.joined.size();
+    }
+    return true;
+}
+
+// the filtered rows are an exact size, so they inflate straight into one buffer
+static bool inflateRows(const PngImage &png, unsigned char *rows, size_t size)
+{
+    TRACE_SCOPE("inflate");
+    
+#ifdef HAVE_ZLIB
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+    stream.next_in = (Bytef*) png.compressed;
+    stream.avail_in = (uInt) png.compressedSize;
+    stream.next_out = rows;
+    stream.avail_out = (uInt) size;
+    int result = inflate(&stream, Z_FINISH);
+    size_t written = stream.total_out;
+    inflateEnd(&stream);
+    
+    // some encoders pad the stream past the last row, that's only a full buffer
+    return (result == Z_STREAM_END || result == Z_BUF_ERROR) && written == size;
+#else
+    return stbi_zlib_decode_buffer((char*) rows, (int) size, (const char*) png.compressed,
+                                   (int) png.compressedSize) == (int) size;
+#endif
+}
+
+// === unfilter =======================================
+enum
+{
+    FILTER_NONE,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVG,
+    FILTER_PAETH
+};
+
+static int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// prior is a zeroed row for the first one, which is what the first row filters assume
+static void unfilterRowScalar(int filter, const unsigned char *raw, const unsigned char *prior, unsigned char *cur,
+                              size_t length, unsigned int bpp)
+{
+    size_t i;
+    switch (filter) {
+    case FILTER_NONE:
+        memcpy(cur, raw, length);
+        break;
+    case FILTER_SUB:
+        for (i = 0; i < bpp; i++)
+            cur[i] = raw[i];
+        for (; i < length; i++)
+            cur[i] = raw[i] + cur[i - bpp];
+        break;
+    case FILTER_UP:
+        for (i = 0; i < length; i++)
+            cur[i] = raw[i] + prior[i];
+        break;
+    case FILTER_AVG:
+        for (i = 0; i < bpp; i++)
+            cur[i] = raw[i] + (prior[i] >> 1);
+        for (; i < length; i++)
+            cur[i] = raw[i] + ((prior[i] + cur[i - bpp]) >> 1);
+        break;
+    case FILTER_PAETH:
+        for (i = 0; i < bpp; i++)
+            cur[i] = raw[i] + prior[i];
+        for (; i < length; i++)
+            cur[i] = raw[i] + paeth(cur[i - bpp], prior[i], prior[i - bpp]);
+        break;
+    }
+}
+
+#ifdef DECODER_SSE
+
+// always 4 bytes, the row buffers are padded so a 3 byte pixel can read one past the end
+static __m128i loadPixel(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return _mm_cvtsi32_si128(v);
+}
+
+// the extra byte of a 3 byte pixel is overwritten by the next one, except at the end of the row
+template <unsigned int BPP>
+static void storePixel(unsigned char *p, __m128i v, bool last)
+{
+    uint32_t x = _mm_cvtsi128_si32(v);
+    memcpy(p, &x, BPP == 4 || !last ? 4 : 3);
+}
+
+static __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static __m128i abs16(__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+// sub, avg and paeth depend on the pixel to the left, so 3 and 4 byte
+// pixels go one per step with every channel in one register
+template <unsigned int BPP>
+static void unfilterRowSse(int filter, const unsigned char *raw, const unsigned char *prior, unsigned char *cur,
+                           size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    
+    switch (filter) {
+    case FILTER_SUB:
+        for (size_t i = 0; i < length; i += BPP) {
+            a = _mm_add_epi8(a, loadPixel(raw + i));
+            storePixel<BPP>(cur + i, a, i + BPP == length);
+        }
+        break;
+    case FILTER_AVG: {
+        // avg_epu8 rounds up, the filter rounds down
+        const __m128i one = _mm_set1_epi8(1);
+        for (size_t i = 0; i < length; i += BPP) {
+            __m128i b = loadPixel(prior + i);
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(loadPixel(raw + i), average);
+            storePixel<BPP>(cur + i, a, i + BPP == length);
+        }
+        break;
+    }
+    case FILTER_PAETH: {
+        // p - a = b - c, p - b = a - c and p - c is their sum, in 16-bit lanes
+        __m128i c = zero;
+        for (size_t i = 0; i < length; i += BPP) {
+            __m128i b = _mm_unpacklo_epi8(loadPixel(prior + i), zero);
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = abs16(_mm_add_epi16(pa, pb));
+            pa = abs16(pa);
+            pb = abs16(pb);
+            
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            __m128i nearest = select(_mm_cmpeq_epi16(smallest, pa), a,
+                                     select(_mm_cmpeq_epi16(smallest, pb), b, c));
+            
+            __m128i x = _mm_unpacklo_epi8(loadPixel(raw + i), zero);
+            a = _mm_and_si128(_mm_add_epi16(nearest, x), _mm_set1_epi16(0xff));
+            storePixel<BPP>(cur + i, _mm_packus_epi16(a, a), i + BPP == length);
+            c = b;
+        }
+        break;
+    }
+    default:
+        unfilterRowScalar(filter, raw, prior, cur, length, BPP);
+        break;
+    }
+}
+
+static void unfilterRow(int filter, const unsigned char *raw, const unsigned char *prior, unsigned char *cur,
+                        size_t length, unsigned int bpp)
+{
+    if (filter == FILTER_UP) {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*) (raw + i)),
+                                       _mm_loadu_si128((const __m128i*) (prior + i)));
+            _mm_storeu_si128((__m128i*) (cur + i), sum);
+        }
+        for (; i < length; i++)
+            cur[i] = raw[i] + prior[i];
+    } else if (bpp == 4) {
+        unfilterRowSse<4>(filter, raw, prior, cur, length);
+    } else if (bpp == 3) {
+        unfilterRowSse<3>(filter, raw, prior, cur, length);
+    } else {
+        unfilterRowScalar(filter, raw, prior, cur, length, bpp);
+    }
+}
+
+#else
+
+static void unfilterRow(int filter, const unsigned char *raw, const unsigned char *prior, unsigned char *cur,
+                        size_t length, unsigned int bpp)
+{
+    unfilterRowScalar(filter, raw, prior, cur, length, bpp);
+}
+
+#endif
+
+// === decode =========================================
+// same conversions and luma weights as stb_image
+static unsigned char* convertChannels(unsigned char *pixels, size_t count, int from, int to)
+{
+    unsigned char *converted = (unsigned char*) malloc(count * to);
+    if (!converted) {
+        free(pixels);
+        return nullptr;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char *in = pixels + i * from;
+        unsigned char *out = converted + i * to;
+        unsigned char r = in[0], g = from >= 3 ? in[1] : in[0], b = from >= 3 ? in[2] : in[0];
+        unsigned char alpha = from == 2 ? in[1] : from == 4 ? in[3] : 255;
+        unsigned char luma = (r * 77 + g * 150 + b * 29) >> 8;
+        
+        switch (to) {
+        case 1: out[0] = luma; break;
+        case 2: out[0] = luma; out[1] = alpha; break;
+        case 3: out[0] = r; out[1] = g; out[2] = b; break;
+        default: out[0] = r; out[1] = g; out[2] = b; out[3] = alpha; break;
+        }
+    }
+    
+    free(pixels);
+    return converted;
+}
+
+static unsigned char* decode(const std::string &path, int &width, int &height, int &channels, int desiredChannels,
+                             bool simd)
+{
+    MappedFile file;
+    PngImage png;
+    if (!file.open(path) || !parsePng(file.data(), file.size(), png))
+        return stbi_load(path.c_str(), &width, &height, &channels, desiredChannels);
+    
+    size_t length = (size_t) png.width * png.channels;
+    size_t rowsSize = (length + 1) * png.height;
+    // the rows and the zero row are padded for the simd pixel loads
+    unsigned char *pixels = (unsigned char*) malloc(length * png.height);
+    unsigned char *rows = (unsigned char*) calloc(rowsSize + 4, 1);
+    unsigned char *zeroRow = (unsigned char*) calloc(length + 4, 1);
+    bool decoded = pixels && rows && zeroRow && inflateRows(png, rows, rowsSize);
+    
+    if (decoded) {
+        TRACE_SCOPE("unfilter");
+        for (unsigned int y = 0; y < png.height && decoded; y++) {
+            const unsigned char *raw = &rows[y * (length + 1)];
+            const unsigned char *prior = y ? pixels + (y - 1) * length : zeroRow;
+            unsigned char *cur = pixels + y * length;
+            if (raw[0] > FILTER_PAETH) {
+                decoded = false;
+            } else if (simd) {
+                unfilterRow(raw[0], raw + 1, prior, cur, length, png.channels);
+            } else {
+                unfilterRowScalar(raw[0], raw + 1, prior, cur, length, png.channels);
+            }
+        }
+    }
+    
+    free(rows);
+    free(zeroRow);
+    if (!decoded) {
+        // out of memory or something the fast path got wrong, stb_image has the last word
+        free(pixels);
+        return stbi_load(path.c_str(), &width, &height, &channels, desiredChannels);
+    }
+    
+    width = png.width;
+    height = png.height;
+    channels = png.channels;
+    if (desiredChannels && desiredChannels != (int) png.channels)
+        pixels = convertChannels(pixels, (size_t) png.width * png.height, png.channels, desiredChannels);
+    return pixels;
+}
+
+unsigned char* decodeImage(const std::string &path, int &width, int &height, int &channels, int desiredChannels)
+{
+    return decode(path, width, height, channels, desiredChannels, true);
+}
+
+unsigned char* decodeImageScalar(const std::string &path, int &width, int &height, int &channels, int desiredChannels)
+{
+    return decode(path, width, height, channels, desiredChannels, false);
+}
+
+const char* decodeImagePath()
+{
+#if defined(DECODER_SSE) && defined(HAVE_ZLIB)
+    return "sse2 unfilter, zlib inflate";
+#elif defined(DECODER_SSE)
+    return "sse2 unfilter, stb_image inflate";
+#elif defined(HAVE_ZLIB)
+    return "scalar unfilter, zlib inflate";
+#else
+    return "scalar unfilter, stb_image inflate";
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+// Drop-in replacement for stbi_load. Non-interlaced 8-bit grey, grey+alpha,
+// rgb and rgba pngs, which is what the textures are, take a faster path:
+// the whole IDAT stream is inflated into one buffer sized up front (with
+// zlib when it was found at build time) and rows are unfiltered with sse2.
+// Everything else is handed to stb_image. Free the result with
+// stbi_image_free either way.
+unsigned char* decodeImage(const std::string &path, int &width, int &height, int &channels, int desiredChannels);
+
+// the scalar unfilter, kept for the benchmark and as the reference for the simd one
+unsigned char* decodeImageScalar(const std::string &path, int &width, int &height, int &channels, int desiredChannels);
+
+// which paths decodeImage was built with, e.g. "sse2 unfilter, zlib inflate"
+const char* decodeImagePath();
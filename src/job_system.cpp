@@ -0,0 +1,204 @@
+#include <algorithm>
+
+#include "job_system.h"
+#include "trace.h"
+
+// which worker of which system the current thread is, none for outside threads
+static thread_local JobSystem *currentSystem = nullptr;
+static thread_local unsigned int currentWorker = 0;
+
+// === deque ==========================================
+void JobSystem::Deque::write(int64_t index, const Job &job)
+{
+    Slot &slot = slots[index & (CAPACITY - 1)];
+    slot.fn.store(job.fn, std::memory_order_relaxed);
+    slot.data.store(job.data, std::memory_order_relaxed);
+    slot.range.store((uint64_t) job.begin << 32 | job.end, std::memory_order_relaxed);
+    slot.counter.store(job.counter, std::memory_order_relaxed);
+}
+
+void JobSystem::Deque::read(int64_t index, Job &job) const
+{
+    const Slot &slot = slots[index & (CAPACITY - 1)];
+    job.fn = slot.fn.load(std::memory_order_relaxed);
+    job.data = slot.data.load(std::memory_order_relaxed);
+    uint64_t range = slot.range.load(std::memory_order_relaxed);
+    job.begin = (uint32_t) (range >> 32);
+    job.end = (uint32_t) range;
+    job.counter = slot.counter.load(std::memory_order_relaxed);
+}
+
+// owner only
+bool JobSystem::Deque::push(const Job &job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= CAPACITY)
+        return false;
+    
+    // release publishes the slot to thieves that acquire bottom
+    write(b, job);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+// owner only, newest first
+bool JobSystem::Deque::pop(Job &job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    read(b, job);
+    if (t == b) {
+        // last one, race the thieves for it
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+// any thread, oldest first
+bool JobSystem::Deque::steal(Job &job)
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+    
+    read(t, job);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+// === scheduler ======================================
+bool JobSystem::create(unsigned int threadCount)
+{
+    if (!threadCount)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    
+    stopping = false;
+    for (unsigned int i = 0; i < threadCount; i++)
+        deques.emplace_back(new Deque());
+    
+    currentSystem = this;
+    currentWorker = 0;
+    for (unsigned int i = 1; i < threadCount; i++)
+        threads.emplace_back(&JobSystem::work, this, i);
+    return true;
+}
+
+void JobSystem::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+    threads.clear();
+    deques.clear();
+    
+    if (currentSystem == this)
+        currentSystem = nullptr;
+}
+
+void JobSystem::run(JobFunction fn, void *data, uint32_t begin, uint32_t end, JobCounter &counter)
+{
+    Job job = { fn, data, begin, end, &counter };
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    
+    if (currentSystem != this || !deques[currentWorker]->push(job)) {
+        execute(job);
+        return;
+    }
+    
+    // pairs with the sleepers check in work(), either it sees the job or we see it sleeping
+    queued.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_one();
+    }
+}
+
+// own deque first, then the others starting at a different one for each thief
+bool JobSystem::take(unsigned int worker, Job &job)
+{
+    if (deques[worker]->pop(job)) {
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    static thread_local uint32_t seed = 2463534242u;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    
+    size_t count = deques.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t victim = (seed + i) % count;
+        if (victim != worker && deques[victim]->steal(job)) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(const Job &job)
+{
+    job.fn(job.data, job.begin, job.end);
+    job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+    TRACE_SCOPE("wait jobs");
+    
+    Job job;
+    while (counter.pending.load(std::memory_order_acquire)) {
+        if (currentSystem == this && take(currentWorker, job))
+            execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::work(unsigned int worker)
+{
+    traceThreadName("job worker");
+    currentSystem = this;
+    currentWorker = worker;
+    
+    Job job;
+    for (;;) {
+        // spin a little before sleeping, batches tend to come in bursts
+        bool found = false;
+        for (int spin = 0; spin < 64 && !found; spin++) {
+            found = take(worker, job);
+            if (!found)
+                std::this_thread::yield();
+        }
+        
+        if (found) {
+            TRACE_SCOPE("job");
+            execute(job);
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_seq_cst); });
+        sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        if (stopping)
+            return;
+    }
+}
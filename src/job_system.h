@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the jobs of a batch that haven't finished; wait() on it.
+struct JobCounter
+{
+    std::atomic<uint32_t> pending { 0 };
+};
+
+// Work-stealing scheduler. Every worker owns a Chase-Lev deque: it pushes
+// and pops jobs at the bottom, idle workers steal from the top of someone
+// else's. The thread that calls create() is worker 0, here the main thread
+// that simulates and builds the frame packets, so it takes part in its own
+// batches instead of blocking. The render thread isn't a worker and submits
+// no jobs. Dependencies are counters: a job
+// decrements its counter when done and wait() keeps executing other jobs
+// until the counter drains, so a waiting job never parks a thread.
+class JobSystem
+{
+public:
+    typedef void (*JobFunction)(void *data, uint32_t begin, uint32_t end);
+    
+    // threads counts the calling thread, 0 uses every core
+    bool create(unsigned int threads = 0);
+    void destroy();
+    
+    unsigned int threadCount() const { return (unsigned int) deques.size(); }
+    
+    // queues fn(data, begin, end) on the calling worker's deque, runs it
+    // inline when called from outside the system or the deque is full
+    void run(JobFunction fn, void *data, uint32_t begin, uint32_t end, JobCounter &counter);
+    void wait(JobCounter &counter);
+    
+    // fn(begin, end) over [begin, end) in pieces of at most grain; ranges
+    // split in halves so a thief takes the largest piece left
+    template <typename Fn>
+    void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, const Fn &fn);
+
+private:
+    struct Job
+    {
+        JobFunction fn;
+        void *data;
+        uint32_t begin, end;
+        JobCounter *counter;
+    };
+    
+    // Chase-Lev deque, after Le et al., "Correct and Efficient Work-Stealing
+    // for Weak Memory Models". Slots are atomics because a thief may read
+    // one while the owner overwrites it; the thief's CAS on top fails then.
+    class Deque
+    {
+    public:
+        static const int64_t CAPACITY = 4096;
+        
+        bool push(const Job &job);
+        bool pop(Job &job);
+        bool steal(Job &job);
+        
+    private:
+        struct Slot
+        {
+            std::atomic<JobFunction> fn;
+            std::atomic<void*> data;
+            std::atomic<uint64_t> range;
+            std::atomic<JobCounter*> counter;
+        };
+        
+        void write(int64_t index, const Job &job);
+        void read(int64_t index, Job &job) const;
+        
+        alignas(64) std::atomic<int64_t> top { 0 };
+        alignas(64) std::atomic<int64_t> bottom { 0 };
+        Slot slots[CAPACITY];
+    };
+    
+    template <typename Fn>
+    struct ForData
+    {
+        JobSystem *jobs;
+        const Fn *fn;
+        uint32_t grain;
+        JobCounter *counter;
+    };
+    
+    template <typename Fn>
+    static void forJob(void *data, uint32_t begin, uint32_t end);
+    
+    bool take(unsigned int worker, Job &job);
+    void execute(const Job &job);
+    void work(unsigned int worker);
+    
+    std::vector<std::unique_ptr<Deque>> deques;
+    std::vector<std::thread> threads;
+    
+    // idle workers sleep until something is queued
+    std::atomic<uint32_t> queued { 0 };
+    std::atomic<uint32_t> sleepers { 0 };
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+template <typename Fn>
+void JobSystem::forJob(void *data, uint32_t begin, uint32_t end)
+{
+    ForData<Fn> &range = *(ForData<Fn>*) data;
+    while (end - begin > range.grain) {
+        uint32_t middle = begin + (end - begin) / 2;
+        range.jobs->run(forJob<Fn>, data, middle, end, *range.counter);
+        end = middle;
+    }
+    (*range.fn)(begin, end);
+}
+
+template <typename Fn>
+void JobSystem::parallelFor(uint32_t begin, uint32_t end, uint32_t grain, const Fn &fn)
+{
+    if (end - begin <= grain || deques.size() < 2) {
+        if (begin < end)
+            fn(begin, end);
+        return;
+    }
+    
+    JobCounter counter;
+    ForData<Fn> range = { this, &fn, grain ? grain : 1, &counter };
+    run(forJob<Fn>, &range, begin, end, counter);
+    wait(counter);
+}
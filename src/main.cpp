@@ -1,8 +1,63 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "benchmarks.h"
 #include "oglrenderer.h"
 
-int main(void)
+int main(int argc, char* argv[])
 {
-    OGLRenderer renderer;
+    RendererParams params;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cubes") && i + 1 < argc)
+            params.cubeCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--loop"))
+            params.instanced = false;
+        else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc)
+            params.benchmarkFrames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--benchmark-layouts") && i + 1 < argc)
+            params.layoutBenchmarkFrames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--layout") && i + 1 < argc) {
+            const char *layout = argv[++i];
+            if (!strcmp(layout, "float"))
+                params.vertexFormat = VertexFormat::Float;
+            else if (!strcmp(layout, "compact"))
+                params.vertexFormat = VertexFormat::Compact;
+            else
+                params.vertexFormat = VertexFormat::Packed;
+        }
+        else if (!strcmp(argv[i], "--no-cull"))
+            params.culling = CullMode::None;
+        else if (!strcmp(argv[i], "--bvh"))
+            params.culling = CullMode::Bvh;
+        else if (!strcmp(argv[i], "--headless"))
+            params.headless = true;
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            params.frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--stats") && i + 1 < argc)
+            params.statsInterval = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            params.modelPath = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            params.tracePath = argv[++i];
+        else if (!strcmp(argv[i], "--no-texture-compression"))
+            params.compressTextures = false;
+        else if (!strcmp(argv[i], "--virtual-texture") && i + 1 < argc)
+            params.virtualTexturePath = argv[++i];
+        else if (!strcmp(argv[i], "--vt-pages") && i + 1 < argc)
+            params.virtualTexturePages = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            params.jobThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sim-hz") && i + 1 < argc)
+            params.simulationHz = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+            return runBenchmark(argv[i + 1], std::vector<std::string>(argv + i + 2, argv + argc)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (params.headless && !params.frames && !params.benchmarkFrames && !params.layoutBenchmarkFrames)
+        params.frames = 1000;
+
+    OGLRenderer renderer(params);
     renderer.run();
     return 0;
 }
@@ -0,0 +1,105 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+
+bool fileStamp(const std::string &path, uint64_t &size, int64_t &time)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st))
+        return false;
+    size = st.st_size;
+    time = st.st_mtime;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+    
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart) {
+        close();
+        return false;
+    }
+    
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+        bytes = (const unsigned char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!bytes) {
+        close();
+        return false;
+    }
+    
+    length = fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+    bytes = nullptr;
+    mapping = nullptr;
+    file = nullptr;
+    length = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        ::close(fd);
+        return false;
+    }
+    
+    // the mapping keeps the file referenced, the descriptor isn't needed anymore
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    
+    bytes = (const unsigned char*) p;
+    length = st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+        munmap((void*) bytes, length);
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
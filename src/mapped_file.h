@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    bool open(const std::string &path);
+    void close();
+    
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#endif
+};
+
+// size and modification time, what the file caches use to notice a changed source
+bool fileStamp(const std::string &path, uint64_t &size, int64_t &time);
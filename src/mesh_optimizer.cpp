@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "mesh_optimizer.h"
+
+std::vector<uint32_t> indexVertices(const void *vertices, size_t count, size_t stride,
+                                    std::vector<unsigned char> &unique)
+{
+    const unsigned char *data = (const unsigned char*) vertices;
+    
+    // keys are vertex numbers, hashed and compared by their bytes
+    auto hash = [&](uint32_t v) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < stride; i++)
+            h = (h ^ data[v * stride + i]) * 16777619u;
+        return (size_t) h;
+    };
+    auto equal = [&](uint32_t a, uint32_t b) {
+        return !memcmp(data + a * stride, data + b * stride, stride);
+    };
+    std::unordered_map<uint32_t, uint32_t, decltype(hash), decltype(equal)> seen(count, hash, equal);
+    
+    std::vector<uint32_t> remap(count);
+    unique.clear();
+    unique.reserve(count * stride);
+    
+    for (uint32_t v = 0; v < count; v++) {
+        auto inserted = seen.emplace(v, (uint32_t) (unique.size() / stride));
+        if (inserted.second)
+            unique.insert(unique.end(), data + v * stride, data + (v + 1) * stride);
+        remap[v] = inserted.first->second;
+    }
+    
+    return remap;
+}
+
+// === vertex cache ===================================
+static const int CACHE_SIZE = 32;
+static const int MAX_VALENCE = 32;
+
+static float cacheScores[CACHE_SIZE];
+static float valenceScores[MAX_VALENCE + 1];
+
+static void initScores()
+{
+    // the last triangle's vertices score the same whichever order they are used in
+    for (int i = 0; i < CACHE_SIZE; i++)
+        cacheScores[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / float(CACHE_SIZE - 3), 1.5f);
+    
+    // vertices with few triangles left are worth finishing off
+    valenceScores[0] = 0.0f;
+    for (int i = 1; i <= MAX_VALENCE; i++)
+        valenceScores[i] = 2.0f / sqrtf((float) i);
+}
+
+static float vertexScore(int cachePosition, unsigned int remaining)
+{
+    if (!remaining)
+        return -1.0f;
+    float score = cachePosition >= 0 ? cacheScores[cachePosition] : 0.0f;
+    return score + valenceScores[std::min<unsigned int>(remaining, MAX_VALENCE)];
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+    
+    static bool scoresReady = (initScores(), true);
+    (void) scoresReady;
+    
+    // triangles of every vertex, the first remaining[v] of each list are not emitted yet
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        remaining[indices[i]]++;
+    
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacency[filled[indices[i]]++] = i / 3;
+    
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+    
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+    
+    uint32_t cache[CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t scan = 0;    // next triangle to try when nothing in the cache has work left
+    
+    while (output.size() < triangleCount * 3) {
+        // best triangle that uses a cached vertex
+        int best = -1;
+        float bestScore = -1.0f;
+        for (int c = 0; c < cacheCount; c++) {
+            uint32_t v = cache[c];
+            for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+                uint32_t t = adjacency[a];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (best < 0) {
+            while (emitted[scan])
+                scan++;
+            best = scan;
+        }
+        
+        emitted[best] = true;
+        const uint32_t *triangle = &indices[best * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        
+        // drop the triangle from its vertices' lists and move them to the front of the cache
+        uint32_t newCache[CACHE_SIZE + 3];
+        int newCount = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = triangle[k];
+            uint32_t *first = &adjacency[offsets[v]];
+            uint32_t *last = first + remaining[v];
+            std::swap(*std::find(first, last, (uint32_t) best), *(last - 1));
+            remaining[v]--;
+            
+            if (std::find(newCache, newCache + newCount, v) == newCache + newCount)
+                newCache[newCount++] = v;
+        }
+        for (int c = 0; c < cacheCount; c++) {
+            if (std::find(newCache, newCache + newCount, cache[c]) == newCache + newCount)
+                newCache[newCount++] = cache[c];
+        }
+        
+        // rescore everything that moved, including what just fell out
+        for (int c = 0; c < newCount; c++) {
+            uint32_t v = newCache[c];
+            cachePosition[v] = c < CACHE_SIZE ? c : -1;
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        for (int c = 0; c < newCount; c++) {
+            uint32_t v = newCache[c];
+            for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+                uint32_t t = adjacency[a];
+                triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+            }
+        }
+        
+        cacheCount = std::min(newCount, CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+    
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// === vertex fetch ===================================
+size_t optimizeVertexFetch(void *vertices, size_t vertexCount, size_t stride,
+                           uint32_t *indices, size_t indexCount)
+{
+    const uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(vertexCount, UNUSED);
+    unsigned char *data = (unsigned char*) vertices;
+    std::vector<unsigned char> original(data, data + vertexCount * stride);
+    
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t &target = remap[indices[i]];
+        if (target == UNUSED) {
+            target = next++;
+            memcpy(data + target * stride, &original[indices[i] * stride], stride);
+        }
+        indices[i] = target;
+    }
+    
+    return next;
+}
+
+float computeAcmr(const uint32_t *indices, size_t indexCount, unsigned int cacheSize)
+{
+    if (indexCount < 3)
+        return 0.0f;
+    
+    std::vector<uint32_t> fifo(cacheSize, ~0u);
+    unsigned int head = 0;
+    size_t misses = 0;
+    
+    for (size_t i = 0; i < indexCount; i++) {
+        if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end()) {
+            fifo[head] = indices[i];
+            head = (head + 1) % cacheSize;
+            misses++;
+        }
+    }
+    
+    return misses / float(indexCount / 3);
+}
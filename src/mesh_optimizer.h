@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Index buffer and vertex order optimizations for triangle lists. Vertices
+// are treated as opaque stride sized blobs, so any packed layout works.
+
+// Merges bit identical vertices. Returns an index into unique for every
+// input vertex, unique receives the distinct vertices in first-use order.
+std::vector<uint32_t> indexVertices(const void *vertices, size_t count, size_t stride,
+                                    std::vector<unsigned char> &unique);
+
+// Reorders triangles for the post-transform vertex cache (Forsyth's
+// linear-speed algorithm), the triangles themselves are unchanged.
+void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Reorders vertices into the order the indices first use them and remaps
+// the indices. Unreferenced vertices are dropped, returns the new count.
+size_t optimizeVertexFetch(void *vertices, size_t vertexCount, size_t stride,
+                           uint32_t *indices, size_t indexCount);
+
+// Average cache miss ratio, transformed vertices per triangle with a FIFO
+// cache of cacheSize entries. 3 is the worst case, 0.5 the best on a grid.
+float computeAcmr(const uint32_t *indices, size_t indexCount, unsigned int cacheSize = 16);
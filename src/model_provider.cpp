@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <gtc/matrix_transform.hpp>
+
+#include "mesh_optimizer.h"
+#include "model_provider.h"
+#include "trace.h"
+#include "vertex_layout.h"
+
+VertexLayout meshCacheLayout()
+{
+    VertexLayout layout;
+    layout.add(hashName("vPos"), AttribFormat::Unorm16x4)
+          .add(hashName("vNormal"), AttribFormat::Snorm10x3)
+          .add(hashName("vTxt"), AttribFormat::Half2);
+    return layout;
+}
+
+glm::mat4 Model::dequantize() const
+{
+    glm::vec3 min(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+    glm::vec3 max(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+    return glm::scale(glm::translate(glm::mat4(1.0f), min), max - min);
+}
+
+// count elements of stride bytes at offset lie inside a file of size bytes
+static bool inFile(uint64_t offset, uint64_t count, uint64_t stride, size_t size)
+{
+    return offset <= size && count * stride <= size - offset;
+}
+
+// every index names a vertex and every submesh lies inside the index buffer,
+// otherwise drawing reads past the end of the vertex or index buffer
+static bool validContents(const unsigned char *data, const MeshCacheHeader &header)
+{
+    const unsigned char *indices = data + header.indexOffset;
+    uint32_t maxIndex = 0;
+    if (header.indexSize == 2) {
+        for (uint32_t i = 0; i < header.indexCount; i++)
+            maxIndex = std::max<uint32_t>(maxIndex, ((const uint16_t*) indices)[i]);
+    } else {
+        for (uint32_t i = 0; i < header.indexCount; i++)
+            maxIndex = std::max(maxIndex, ((const uint32_t*) indices)[i]);
+    }
+    if (header.indexCount && maxIndex >= header.vertexCount)
+        return false;
+    
+    const Submesh *submeshes = (const Submesh*) (data + header.submeshOffset);
+    for (uint32_t i = 0; i < header.submeshCount; i++) {
+        if (submeshes[i].firstIndex > header.indexCount
+            || submeshes[i].indexCount > header.indexCount - submeshes[i].firstIndex)
+            return false;
+    }
+    return true;
+}
+
+static bool mapCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime, Model &model)
+{
+    if (!model.file.open(cachePath))
+        return false;
+    
+    const unsigned char *data = model.file.data();
+    size_t size = model.file.size();
+    const MeshCacheHeader *header = (const MeshCacheHeader*) data;
+    
+    if (size < sizeof(MeshCacheHeader)
+        || memcmp(header->magic, "GTMC", 4)
+        || header->version != MESH_CACHE_VERSION
+        || header->sourceSize != sourceSize
+        || header->sourceTime != sourceTime
+        || (header->indexSize != 2 && header->indexSize != 4)
+        || !inFile(header->vertexOffset, header->vertexCount, sizeof(PackedVertex), size)
+        || !inFile(header->indexOffset, header->indexCount, header->indexSize, size)
+        || !inFile(header->submeshOffset, header->submeshCount, sizeof(Submesh), size)
+        || !inFile(header->materialOffset, header->materialCount, sizeof(MaterialRef), size)
+        || !validContents(data, *header)) {
+        model.file.close();
+        return false;
+    }
+    
+    model.header = header;
+    model.vertices = (const PackedVertex*) (data + header->vertexOffset);
+    model.indices = data + header->indexOffset;
+    model.submeshes = (const Submesh*) (data + header->submeshOffset);
+    model.materials = (const MaterialRef*) (data + header->materialOffset);
+    return true;
+}
+
+static size_t align4(size_t offset)
+{
+    return (offset + 3) & ~size_t(3);
+}
+
+static bool importModel(const std::string &path, const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime)
+{
+    TRACE_SCOPE("import model");
+    
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(path,
+        aiProcess_Triangulate |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_GenSmoothNormals |
+        aiProcess_PreTransformVertices |
+        aiProcess_SortByPType);
+    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
+        std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+        return false;
+    }
+    
+    // all meshes go into one vertex and index buffer, one submesh each
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    uint32_t vertexCount = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+        const aiMesh *mesh = scene->mMeshes[m];
+        if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE))
+            continue;
+        for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+            const aiVector3D &p = mesh->mVertices[v];
+            boundsMin = glm::min(boundsMin, glm::vec3(p.x, p.y, p.z));
+            boundsMax = glm::max(boundsMax, glm::vec3(p.x, p.y, p.z));
+        }
+        vertexCount += mesh->mNumVertices;
+    }
+    if (!vertexCount) {
+        std::cout << "ERROR::MODEL::NO_TRIANGLES\n" << path << std::endl;
+        return false;
+    }
+    
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 scale(extent.x > 0.0f ? 65535.0f / extent.x : 0.0f,
+                    extent.y > 0.0f ? 65535.0f / extent.y : 0.0f,
+                    extent.z > 0.0f ? 65535.0f / extent.z : 0.0f);
+    
+    std::vector<PackedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Submesh> submeshes;
+    vertices.reserve(vertexCount);
+    
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+        const aiMesh *mesh = scene->mMeshes[m];
+        if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE))
+            continue;
+        
+        uint32_t baseVertex = vertices.size();
+        Submesh submesh = { (uint32_t) indices.size(), 0, mesh->mMaterialIndex };
+        
+        for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+            const aiVector3D &p = mesh->mVertices[v];
+            PackedVertex vertex = {};
+            vertex.position[0] = (uint16_t) std::lround((p.x - boundsMin.x) * scale.x);
+            vertex.position[1] = (uint16_t) std::lround((p.y - boundsMin.y) * scale.y);
+            vertex.position[2] = (uint16_t) std::lround((p.z - boundsMin.z) * scale.z);
+            if (mesh->HasNormals())
+                vertex.normal = packSnorm10(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z);
+            if (mesh->HasTextureCoords(0)) {
+                vertex.uv[0] = floatToHalf(mesh->mTextureCoords[0][v].x);
+                vertex.uv[1] = floatToHalf(mesh->mTextureCoords[0][v].y);
+            }
+            vertices.push_back(vertex);
+        }
+        
+        for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
+            const aiFace &face = mesh->mFaces[f];
+            if (face.mNumIndices != 3)
+                continue;
+            for (unsigned int i = 0; i < 3; i++)
+                indices.push_back(baseVertex + face.mIndices[i]);
+        }
+        
+        submesh.indexCount = indices.size() - submesh.firstIndex;
+        submeshes.push_back(submesh);
+    }
+    
+    // quantizing can make more vertices identical than the importer joined
+    float acmr = computeAcmr(indices.data(), indices.size());
+    size_t importedCount = vertices.size();
+    {
+        TRACE_SCOPE("optimize mesh");
+        std::vector<unsigned char> unique;
+        std::vector<uint32_t> remap = indexVertices(vertices.data(), vertices.size(), sizeof(PackedVertex), unique);
+        for (uint32_t &index : indices)
+            index = remap[index];
+        vertices.resize(unique.size() / sizeof(PackedVertex));
+        memcpy(vertices.data(), unique.data(), unique.size());
+        
+        // per submesh so their index ranges stay intact
+        for (const Submesh &submesh : submeshes)
+            optimizeVertexCache(&indices[submesh.firstIndex], submesh.indexCount, vertices.size());
+        vertices.resize(optimizeVertexFetch(vertices.data(), vertices.size(), sizeof(PackedVertex),
+                                            indices.data(), indices.size()));
+    }
+    std::cout << "Optimized " << path << ": " << importedCount << " -> " << vertices.size()
+              << " vertices, acmr " << acmr << " -> " << computeAcmr(indices.data(), indices.size()) << std::endl;
+    
+    std::vector<MaterialRef> materials(scene->mNumMaterials);
+    for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
+        aiString texture;
+        memset(materials[i].diffuse, 0, sizeof(materials[i].diffuse));
+        if (scene->mMaterials[i]->GetTexture(aiTextureType_DIFFUSE, 0, &texture) == aiReturn_SUCCESS)
+            strncpy(materials[i].diffuse, texture.C_Str(), sizeof(materials[i].diffuse) - 1);
+    }
+    
+    // === write ==========================================
+    MeshCacheHeader header = {};
+    memcpy(header.magic, "GTMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.vertexCount = vertices.size();
+    header.indexCount = indices.size();
+    header.indexSize = vertices.size() <= 0xffff ? 2 : 4;
+    header.submeshCount = submeshes.size();
+    header.materialCount = materials.size();
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+    header.vertexOffset = sizeof(header);
+    header.indexOffset = header.vertexOffset + vertices.size() * sizeof(PackedVertex);
+    header.submeshOffset = align4(header.indexOffset + indices.size() * header.indexSize);
+    header.materialOffset = header.submeshOffset + submeshes.size() * sizeof(Submesh);
+    
+    // write to a temporary name first so a crash never leaves a truncated cache behind
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "ERROR::MODEL::CACHE_NOT_WRITABLE\n" << cachePath << std::endl;
+        return false;
+    }
+    
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) vertices.data(), vertices.size() * sizeof(PackedVertex));
+    if (header.indexSize == 2) {
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        file.write((const char*) shortIndices.data(), shortIndices.size() * 2);
+    } else {
+        file.write((const char*) indices.data(), indices.size() * 4);
+    }
+    const char padding[4] = {};
+    file.write(padding, header.submeshOffset - (header.indexOffset + indices.size() * header.indexSize));
+    file.write((const char*) submeshes.data(), submeshes.size() * sizeof(Submesh));
+    file.write((const char*) materials.data(), materials.size() * sizeof(MaterialRef));
+    file.close();
+    
+    if (!file) {
+        std::cout << "ERROR::MODEL::CACHE_NOT_WRITABLE\n" << cachePath << std::endl;
+        return false;
+    }
+    
+    std::remove(cachePath.c_str());
+    return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+bool loadModel(const std::string &path, Model &model)
+{
+    TRACE_SCOPE("loadModel");
+    auto start = std::chrono::steady_clock::now();
+    
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!fileStamp(path, sourceSize, sourceTime)) {
+        std::cout << "ERROR::MODEL::FILE_NOT_FOUND\n" << path << std::endl;
+        return false;
+    }
+    
+    std::string cachePath = path + ".meshcache";
+    bool cached = mapCache(cachePath, sourceSize, sourceTime, model);
+    if (!cached) {
+        if (!importModel(path, cachePath, sourceSize, sourceTime))
+            return false;
+        if (!mapCache(cachePath, sourceSize, sourceTime, model)) {
+            std::cout << "ERROR::MODEL::CACHE_NOT_READABLE\n" << cachePath << std::endl;
+            return false;
+        }
+    }
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << (cached ? "Mapped cached model " : "Imported model ") << path << " in " << ms << " ms ("
+              << model.header->vertexCount << " vertices, " << model.header->indexCount << " indices)" << std::endl;
+    return true;
+}
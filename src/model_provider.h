@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <glm.hpp>
+
+#include "mapped_file.h"
+#include "vertex_layout.h"
+
+// Models are imported through Assimp once and written to a binary cache
+// next to the source ("<model>.meshcache"). Later runs map the cache and
+// use it in place, without parsing or post-processing anything.
+
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct MeshCacheHeader
+{
+    char magic[4];              // "GTMC"
+    uint32_t version;
+    uint64_t sourceSize;        // source model this cache was built from,
+    int64_t sourceTime;         // rebuilt when either one changes
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexSize;         // 2 or 4 bytes
+    uint32_t submeshCount;
+    uint32_t materialCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t vertexOffset;      // byte offsets from the start of the file
+    uint64_t indexOffset;
+    uint64_t submeshOffset;
+    uint64_t materialOffset;
+};
+
+// 16 bytes, half of the float vertex this replaces
+struct PackedVertex
+{
+    uint16_t position[4];       // unorm inside the mesh bounds, w unused
+    uint32_t normal;            // GL_INT_2_10_10_10_REV
+    uint16_t uv[2];             // half floats
+};
+
+struct Submesh
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t material;
+};
+
+struct MaterialRef
+{
+    char diffuse[128];          // texture path as written in the model, empty if none
+};
+
+// Points straight into the mapped cache file.
+struct Model
+{
+    MappedFile file;
+    const MeshCacheHeader *header = nullptr;
+    const PackedVertex *vertices = nullptr;
+    const void *indices = nullptr;
+    const Submesh *submeshes = nullptr;
+    const MaterialRef *materials = nullptr;
+    
+    // maps the unorm positions back to model space
+    glm::mat4 dequantize() const;
+};
+
+// PackedVertex as attribute formats
+VertexLayout meshCacheLayout();
+
+bool loadModel(const std::string &path, Model &model);
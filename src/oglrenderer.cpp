@@ -1,28 +1,46 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <gtc/type_ptr.hpp>
-#include <stb_image.h>
 
+#include "buffer_streamer.h"
+#include "file_watcher.h"
+#include "bvh.h"
+#include "entity_store.h"
+#include "frame_mailbox.h"
+#include "frame_profiler.h"
+#include "frustum.h"
+#include "headless.h"
+#include "job_system.h"
+#include "mesh_optimizer.h"
+#include "model_provider.h"
+#include "oglrenderer.h"
+#include "program_cache.h"
 #include "shader_loader.h"
+#include "texture_loader.h"
+#include "trace.h"
+#include "uniform_ring.h"
+#include "vertex_layout.h"
+#include "virtual_texture.h"
 
-class OGLRenderer
-{
-public:
-    OGLRenderer();
-    ~OGLRenderer();
-    void run();
-};
+RendererParams params;
 
 unsigned int SCR_WIDTH = 800;
 unsigned int SCR_HEIGHT = 600;
 
-// camera
-glm::vec3 cameraPos   = glm::vec3(0.0f, 0.0f, 3.0f);
+// camera, the position moves with the simulation below
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 glm::vec3 cameraUp    = glm::vec3(0.0f, 1.0f, 0.0f);
 
@@ -32,24 +50,99 @@ float pitch =  0.0f;
 float lastX =  800.0f / 2.0;
 float lastY =  600.0 / 2.0;
 float fov   =  70.0f;
+bool pickRequested = false;
+bool traceKeyDown = false;
+bool debugUvKeyDown = false;
+
+// simulation, advanced in fixed steps and interpolated between the last
+// two for drawing, so what happens doesn't depend on the frame rate
+struct SimState
+{
+    glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
+    double time = 0.0;      // simulated seconds, spins the cubes
+};
+SimState simPrevious;
+SimState simCurrent;
+double simAccumulator = 0.0;
+const double MAX_FRAME_TIME = 0.25;     // a longer frame drops time instead of stepping ever more to catch up
 
 // timing
-float deltaTime = 0.0f;	// time between current frame and last frame
-float lastFrame = 0.0f;
+std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+std::atomic<bool> closeRequested { false };     // set by either thread, the other one follows
 
 GLFWwindow* window;
-GLuint program;
+ShaderLibrary shaderLibrary;
+ShaderProgram *program = nullptr;
+std::vector<std::string> shaderDefines;     // permutation in use, toggled with U
+bool debugUvWanted = false;                 // switched to once its permutation is ready
+const char *VERTEX_SHADER_PATH = "vertex_shader.glsl";
+const char *FRAGMENT_SHADER_PATH = "fragment_shader.glsl";
+UniformRing cameraRing;
+FrameProfiler profiler;
 
 GLuint vertex_array;
 GLuint vertex_buffer;
 GLuint element_buffer;
+GLuint instance_buffer;
 unsigned int texture;
+TextureLoader textureLoader;
+VirtualTexture virtualTexture;
+bool virtualTextured = false;
+const std::vector<std::string> FEEDBACK_DEFINES = { "VIRTUAL_TEXTURE", "VT_FEEDBACK" };
+
+GLint imodel_location;
+VertexLayout meshLayout;
+
+// mesh drawn for every cube, the built-in cube unless a model was loaded
+Model meshModel;
+glm::mat4 meshMatrix = glm::mat4(1.0f);    // fits the mesh into the unit cube
+GLsizei meshVertexCount = 0;
+GLsizei meshIndexCount = 0;
+GLenum meshIndexType = GL_UNSIGNED_SHORT;
+
+// shader hot reload
+FileWatcher shaderWatcher;
+bool reloadQueued = false;      // edited again while a reload was pending
+
+// scene, visible lists and the hierarchy hold entity slots
+EntityStore scene;
+std::vector<Aabb> sceneAabbs;
+Bvh sceneBvh;
+std::vector<uint32_t> visibleCubes;
+
+// What the render thread needs to draw a frame. The main thread fills one
+// and publishes it whole, the render thread only ever reads it.
+struct FramePacket
+{
+    CameraBlock camera;
+    std::vector<glm::mat4> instanceModels;
+    unsigned int debugUvToggles = 0;    // presses so far, the render thread applies the ones it hasn't seen
+    int viewportWidth = 0;              // framebuffer size after the last resize, 0 before any
+    int viewportHeight = 0;
+};
+
+FrameMailbox<FramePacket> frameMailbox;
+unsigned int debugUvToggles = 0;
+int viewportWidth = 0;
+int viewportHeight = 0;
+
+// per-frame cpu work is split over the job system
+JobSystem jobs;
+const uint32_t CULL_CHUNK = 16384;      // boxes per culling job, multiple of 8 for the simd kernels
+const uint32_t MODEL_GRAIN = 1024;      // instance matrices per job
+const uint32_t TRANSFORM_GRAIN = 2048;  // world matrices per job
+const uint32_t REFIT_GRAIN = 4096;      // bounds per job
+std::vector<std::vector<uint32_t>> cullChunks;
 
 void error_callback(int error, const char* description);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 bool initGLFW(GLFWwindow* &window);
+std::vector<std::string> debugUvDefines(std::vector<std::string> defines);
+void toggleDebugUv();
+void updateDebugUv();
 
 struct
 {
@@ -101,11 +194,6 @@ struct
     { -0.5f,  0.5f, -0.5f,   0.f, 0.f, 0.f,   0.0f, 1.0f }
 };
 
-unsigned int indices[] = {
-    0, 1, 2,
-    1, 2, 3
-};
-    
 glm::vec3 cubePositions[] = {
     glm::vec3( 0.0f,  0.0f,  0.0f),
     glm::vec3( 2.0f,  5.0f, -15.0f),
@@ -119,20 +207,229 @@ glm::vec3 cubePositions[] = {
     glm::vec3(-1.3f,  1.0f, -1.5f)
 };
 
+// seconds since startup, glfwGetTime isn't available without a window
+double getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void requestClose()
+{
+    closeRequested = true;
+    if (window)
+        glfwSetWindowShouldClose(window, true);
+}
+
+// moves the context between the main and the render thread
+void makeContextCurrent(bool current)
+{
+    if (params.headless)
+        makeHeadlessCurrent(current);
+    else
+        glfwMakeContextCurrent(current ? window : NULL);
+}
+
+bool shouldClose()
+{
+    return closeRequested || (window && glfwWindowShouldClose(window));
+}
+
+// transform system, world matrices of whatever moved and boxes of every entity
+void updateScene(float time)
+{
+    jobs.parallelFor(0, scene.size(), TRANSFORM_GRAIN, [time](uint32_t begin, uint32_t end) {
+        scene.updateLocals(begin, end, time);
+    });
+    scene.updateWorlds();
+    jobs.parallelFor(0, scene.size(), TRANSFORM_GRAIN, [](uint32_t begin, uint32_t end) {
+        scene.updateBounds(begin, end);
+    });
+}
+
+// the hierarchy keeps its own copy of the entity boxes, refit it around this frame's
+void refitScene()
+{
+    jobs.parallelFor(0, scene.size(), REFIT_GRAIN, [](uint32_t begin, uint32_t end) {
+        const BoundsSoA &bounds = scene.bounds;
+        for (uint32_t i = begin; i < end; i++) {
+            glm::vec3 center(bounds.cx[i], bounds.cy[i], bounds.cz[i]);
+            glm::vec3 extent(bounds.ex[i], bounds.ey[i], bounds.ez[i]);
+            sceneAabbs[i].min = center - extent;
+            sceneAabbs[i].max = center + extent;
+        }
+    });
+    
+    sceneBvh.refit(sceneAabbs);
+}
+
+VertexLayout cubeLayout(VertexFormat format)
+{
+    VertexLayout layout;
+    switch (format) {
+    case VertexFormat::Float:
+        layout.add(hashName("vPos"), AttribFormat::Float3)
+              .add(hashName("vCol"), AttribFormat::Float3)
+              .add(hashName("vTxt"), AttribFormat::Float2);
+        break;
+    case VertexFormat::Compact:
+        layout.add(hashName("vPos"), AttribFormat::Float3)
+              .add(hashName("vTxt"), AttribFormat::Float2);
+        break;
+    case VertexFormat::Packed:
+        // the cube's corners and uvs are exact in either format
+        layout.add(hashName("vPos"), AttribFormat::Half4)
+              .add(hashName("vTxt"), AttribFormat::Unorm16x2);
+        break;
+    }
+    return layout;
+}
+
+// repacks the cube into the vertex and element buffers, the vao must be bound
+void uploadCube(VertexFormat format, bool report = false)
+{
+    clearLayout(meshLayout, *program);
+    meshLayout = cubeLayout(format);
+    
+    std::vector<VertexStream> streams = {
+        { hashName("vPos"), &vertices[0].x, 3, sizeof(vertices[0]) / sizeof(float) },
+        { hashName("vCol"), &vertices[0].r, 3, sizeof(vertices[0]) / sizeof(float) },
+        { hashName("vTxt"), &vertices[0].tx, 2, sizeof(vertices[0]) / sizeof(float) }
+    };
+    std::vector<unsigned char> packed = packVertices(meshLayout, streams, 36);
+    
+    // the 36 corners of the triangle list collapse to 4 per face
+    std::vector<unsigned char> unique;
+    std::vector<uint32_t> indices = indexVertices(packed.data(), 36, meshLayout.stride, unique);
+    float acmr = computeAcmr(indices.data(), indices.size());
+    
+    meshVertexCount = unique.size() / meshLayout.stride;
+    optimizeVertexCache(indices.data(), indices.size(), meshVertexCount);
+    meshVertexCount = optimizeVertexFetch(unique.data(), meshVertexCount, meshLayout.stride,
+                                          indices.data(), indices.size());
+    if (report) {
+        std::cout << "cube: 36 -> " << meshVertexCount << " vertices, acmr " << acmr
+                  << " -> " << computeAcmr(indices.data(), indices.size()) << std::endl;
+    }
+    
+    std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+    meshIndexCount = shortIndices.size();
+    meshIndexType = GL_UNSIGNED_SHORT;
+    
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, meshVertexCount * meshLayout.stride, unique.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+    applyLayout(meshLayout, *program);
+}
+
+const char* formatName(VertexFormat format)
+{
+    switch (format) {
+    case VertexFormat::Float:   return "float";
+    case VertexFormat::Compact: return "compact";
+    case VertexFormat::Packed:  return "packed";
+    }
+    return "";
+}
+
+// iModel columns from instance_buffer, enabled by setInstanced
+void bindInstanceAttribs()
+{
+    imodel_location = program->attribLocation(hashName("iModel"));
+    if (imodel_location < 0)
+        return;
+    
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    for (int i = 0; i < 4; i++) {
+        glVertexAttribPointer(imodel_location + i, 4, GL_FLOAT, GL_FALSE,
+                              sizeof(glm::mat4), (void*) (sizeof(glm::vec4) * i));
+        glVertexAttribDivisor(imodel_location + i, 1);
+    }
+}
+
+void makeScene(unsigned int count)
+{
+    scene.clear();
+    scene.reserve(count);
+    
+    // every cube spins the same way, one radian per second
+    EntityDesc cube;
+    cube.axis = glm::vec3(0.5f, 1.0f, 0.0f);
+    cube.spin = 1.0f;
+    for (unsigned int i = 0; i < std::min(count, 10u); i++) {
+        cube.position = cubePositions[i];
+        scene.create(cube);
+    }
+    
+    // scatter the rest in front of the camera, fixed seed so runs are comparable
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> xy(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> z(-120.0f, -5.0f);
+    while (scene.size() < count) {
+        cube.position = glm::vec3(xy(rng), xy(rng), z(rng));
+        scene.create(cube);
+    }
+    
+    updateScene(0.0f);
+    sceneAabbs.resize(count);
+    refitScene();
+    sceneBvh.build(sceneAabbs);
+    
+    visibleCubes.reserve(count);
+    cullChunks.resize((count + CULL_CHUNK - 1) / CULL_CHUNK);
+}
+
+// every chunk of boxes culled by its own job, then stitched back in order
+void cullScene(const Frustum &frustum)
+{
+    uint32_t chunkCount = cullChunks.size();
+    jobs.parallelFor(0, chunkCount, 1, [&frustum](uint32_t begin, uint32_t end) {
+        for (uint32_t chunk = begin; chunk < end; chunk++) {
+            size_t first = size_t(chunk) * CULL_CHUNK;
+            size_t last = std::min(first + CULL_CHUNK, scene.bounds.count);
+            cullChunks[chunk].clear();
+            cullBounds(frustum, scene.bounds, first, last, cullChunks[chunk]);
+        }
+    });
+    
+    for (const std::vector<uint32_t> &chunk : cullChunks)
+        visibleCubes.insert(visibleCubes.end(), chunk.begin(), chunk.end());
+}
+
 
 void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+        requestClose();
+    
+    // dump the trace once per press
+    bool traceKey = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (traceKey && !traceKeyDown && traceEnabled)
+        dumpTrace(params.tracePath);
+    traceKeyDown = traceKey;
+    
+    bool debugUvKey = glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS;
+    if (debugUvKey && !debugUvKeyDown)
+        debugUvToggles++;
+    debugUvKeyDown = debugUvKey;
+}
 
-    float cameraSpeed = 2.5 * deltaTime;
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cameraPos += cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cameraPos -= cameraSpeed * cameraFront;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;   
+// one fixed step, movement keys are sampled here rather than once per frame
+void stepSimulation(SimState &state, double step)
+{
+    if (window) {
+        float cameraSpeed = 2.5 * step;
+        glm::vec3 &cameraPos = state.cameraPos;
+        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+            cameraPos += cameraSpeed * cameraFront;
+        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+            cameraPos -= cameraSpeed * cameraFront;
+        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+            cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+            cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+    }
+    
+    state.time += step;
 }
 
 void error_callback(int error, const char* description)
@@ -174,6 +471,13 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     cameraFront = glm::normalize(front);
 }
 
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    // picked in oglRun, where the frame's matrices and cube boxes are known
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+        pickRequested = true;
+}
+
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     if (fov >= 30.0f && fov <= 120.0f)
@@ -188,7 +492,9 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    // Applied by the render thread, this one has no context.
+    viewportWidth = width;
+    viewportHeight = height;
 }
 
 bool initGLFW(GLFWwindow* &window)
@@ -212,6 +518,7 @@ bool initGLFW(GLFWwindow* &window)
     
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
     
     glfwMakeContextCurrent(window);
     
@@ -226,22 +533,63 @@ bool initGLFW(GLFWwindow* &window)
         glfwTerminate();
         return false;
     }
+    loadProgramBinaryExtension((GLADloadproc)glfwGetProcAddress);
+    ProgramBatch::init((GLADloadproc)glfwGetProcAddress);
     
     return true;
 }
 
 void oglRenderer() {
+    if (!params.tracePath.empty()) {
+        traceEnabled = true;
+        traceThreadName("main");
+    }
+    
     // === init ===========================================
-    if (!initGLFW(window))
+    if (params.headless) {
+        if (!initHeadless(SCR_WIDTH, SCR_HEIGHT))
+            exit(EXIT_FAILURE);
+    } else if (!initGLFW(window)) {
         exit(EXIT_FAILURE);
+    }
+    
+    jobs.create(params.jobThreads);
+    
+    virtualTextured = !params.virtualTexturePath.empty();
+    if (virtualTextured)
+        shaderDefines.push_back("VIRTUAL_TEXTURE");
+    
+    // compiles in the background until fetched, if the driver can; every
+    // permutation switched to at runtime is queued here so switching never
+    // compiles, reloads rebuild all of them
+    shaderLibrary.request(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, shaderDefines);
+    shaderLibrary.request(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, debugUvDefines(shaderDefines));
+    if (virtualTextured)
+        shaderLibrary.request(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, FEEDBACK_DEFINES);
     
-    if (!getProgram("vertex_shader.glsl", "fragment_shader.glsl", program)) {
+    if (!cameraRing.create(sizeof(CameraBlock))) {
         glfwTerminate();
         exit(EXIT_FAILURE);
     }
     
+    profiler.init();
+    
     glEnable(GL_DEPTH_TEST);
     
+    if (!params.modelPath.empty() && !loadModel(params.modelPath, meshModel)) {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    
+    program = shaderLibrary.get(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, shaderDefines);
+    if (!program) {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    
+    if (!program->bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING))
+        std::cout << "ERROR::SHADER::CAMERA_BLOCK_NOT_FOUND" << std::endl;
+    
     // === vao, vbo, ebo ==================================
     glGenVertexArrays(1, &vertex_array);
 
@@ -251,115 +599,566 @@ void oglRenderer() {
     
     glBindVertexArray(vertex_array);
     
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    if (!params.modelPath.empty()) {
+        const MeshCacheHeader &header = *meshModel.header;
+        
+        // straight from the mapped cache into immutable buffers
+        BufferStreamer streamer;
+        if (!streamer.create()
+            || !streamer.upload(vertex_buffer, meshModel.vertices, header.vertexCount * sizeof(PackedVertex))
+            || !streamer.upload(element_buffer, meshModel.indices, header.indexCount * header.indexSize)) {
+            std::cout << "Failed to upload model" << std::endl;
+            glfwTerminate();
+            exit(EXIT_FAILURE);
+        }
+        streamer.report();
+        streamer.destroy();
+        
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+        
+        meshLayout = meshCacheLayout();
+        applyLayout(meshLayout, *program);
+        
+        meshVertexCount = header.vertexCount;
+        meshIndexCount = header.indexCount;
+        meshIndexType = header.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        
+        // center on the origin and scale the longest side to 1 so the cube bounds still hold
+        glm::vec3 min(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+        glm::vec3 max(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+        glm::vec3 extent = max - min;
+        // a model collapsed to a point would divide by zero
+        float longest = std::max(1e-6f, std::max(extent.x, std::max(extent.y, extent.z)));
+        meshMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / longest));
+        meshMatrix = glm::translate(meshMatrix, (min + max) * -0.5f);
+        meshMatrix = meshMatrix * meshModel.dequantize();
+    } else {
+        uploadCube(params.vertexFormat, true);
+    }
     
-    GLint vpos_location = glGetAttribLocation(program, "vPos");
-    // GLint vcol_location = glGetAttribLocation(program, "vCol");
-    GLint vtxt_location = glGetAttribLocation(program, "vTxt");
+    // per-instance model matrix, one vec4 attribute per column
+    makeScene(params.cubeCount);
     
-    glVertexAttribPointer(vpos_location, 3, GL_FLOAT, GL_FALSE,
-                          sizeof(vertices[0]), (void*) 0);
-    glEnableVertexAttribArray(vpos_location);
-
-    // glVertexAttribPointer(vcol_location, 3, GL_FLOAT, GL_FALSE,
-                          // sizeof(vertices[0]), (void*) (sizeof(float) * 3));
-    // glEnableVertexAttribArray(vcol_location);
+    glGenBuffers(1, &instance_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, params.cubeCount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
     
-    glVertexAttribPointer(vtxt_location, 2, GL_FLOAT, GL_FALSE, 
-                          sizeof(vertices[0]), (void*) (sizeof(float) * 6));
-    glEnableVertexAttribArray(vtxt_location);
+    bindInstanceAttribs();
     
     // === texture ========================================
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    
-    // set the texture wrapping/filtering options (on the currently bound texture object)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    // load and generate the texture
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load("gato.png", &width, &height, &nrChannels, 0);
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(data);
-    } else {
-        std::cout << "Failed to load texture" << std::endl;
-        stbi_image_free(data);
+    textureLoader.create(params.compressTextures);
+    texture = textureLoader.load("gato.png");
+    
+    if (virtualTextured && !virtualTexture.create(params.virtualTexturePath, params.virtualTexturePages,
+                                                  SCR_WIDTH, SCR_HEIGHT)) {
         glfwTerminate();
         exit(EXIT_FAILURE);
     }
     
+    // === hot reload =====================================
+    if (shaderWatcher.create()) {
+        for (const std::string &file : shaderLibrary.sourceFiles())
+            shaderWatcher.watch(file);
+    }
+    
     // === draw ===========================================
 
-    glUseProgram(program);   
+    program->use();
+    if (virtualTextured)
+        virtualTexture.setUniforms(*program, false);
 }
 
 void oglRendererDestroy() {
+    if (traceEnabled)
+        dumpTrace(params.tracePath);
+    
+    shaderWatcher.destroy();
+    if (virtualTextured)
+        virtualTexture.destroy();
+    textureLoader.destroy();
+    glDeleteTextures(1, &texture);
+    profiler.destroy();
+    cameraRing.destroy();
+    shaderLibrary.clear();
     glDeleteVertexArrays(1, &vertex_array);
+    glDeleteBuffers(1, &instance_buffer);
     glDeleteBuffers(1, &element_buffer);
     glDeleteBuffers(1, &vertex_buffer);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (params.headless) {
+        destroyHeadless();
+    } else {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    jobs.destroy();
 }
 
-void oglRun() {
-    while (!glfwWindowShouldClose(window))
-    {
-        // === input ==========================================
+void pickCube(const glm::mat4 &viewProj)
+{
+    if (params.culling != CullMode::Bvh)
+        refitScene();
+    
+    // unproject the cursor on the near and far planes
+    float x = 2.0f * lastX / SCR_WIDTH - 1.0f;
+    float y = 1.0f - 2.0f * lastY / SCR_HEIGHT;
+    glm::mat4 inverse = glm::inverse(viewProj);
+    glm::vec4 nearPoint = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint.x, nearPoint.y, nearPoint.z) * (1.0f / nearPoint.w);
+    glm::vec3 target = glm::vec3(farPoint.x, farPoint.y, farPoint.z) * (1.0f / farPoint.w);
+    
+    float distance;
+    int cube = sceneBvh.raycast(origin, glm::normalize(target - origin), distance);
+    if (cube >= 0)
+        std::cout << "Picked cube " << scene.entities[cube] << " at distance " << distance << std::endl;
+    else
+        std::cout << "Picked nothing" << std::endl;
+}
+
+void setInstanced(bool instanced)
+{
+    params.instanced = instanced;
+    if (imodel_location < 0)
+        return;
+    
+    // with the arrays disabled the loop path feeds iModel as a constant attribute
+    for (int i = 0; i < 4; i++) {
+        if (instanced)
+            glEnableVertexAttribArray(imodel_location + i);
+        else
+            glDisableVertexAttribArray(imodel_location + i);
+    }
+}
+
+// attribute locations can move between programs, rebuild the vao's pointers
+void switchProgram(ShaderProgram *next, bool feedback = false)
+{
+    for (int i = 0; imodel_location >= 0 && i < 4; i++)
+        glDisableVertexAttribArray(imodel_location + i);
+    clearLayout(meshLayout, *program);
+    
+    program = next;
+    if (!program->bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING))
+        std::cout << "ERROR::SHADER::CAMERA_BLOCK_NOT_FOUND" << std::endl;
+    program->use();
+    
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    applyLayout(meshLayout, *program);
+    bindInstanceAttribs();
+    setInstanced(params.instanced);
+    
+    if (virtualTextured)
+        virtualTexture.setUniforms(*program, feedback);
+}
+
+// the defines with DEBUG_UV flipped
+std::vector<std::string> debugUvDefines(std::vector<std::string> defines)
+{
+    auto debugUv = std::find(defines.begin(), defines.end(), "DEBUG_UV");
+    if (debugUv != defines.end())
+        defines.erase(debugUv);
+    else
+        defines.push_back("DEBUG_UV");
+    return defines;
+}
+
+void toggleDebugUv()
+{
+    debugUvWanted = !debugUvWanted;
+}
+
+// the current program stays in use until the other permutation is ready
+void updateDebugUv()
+{
+    bool debugUv = std::find(shaderDefines.begin(), shaderDefines.end(), "DEBUG_UV") != shaderDefines.end();
+    if (debugUv == debugUvWanted)
+        return;
+    
+    std::vector<std::string> defines = debugUvDefines(shaderDefines);
+    if (!shaderLibrary.ready(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, defines))
+        return;
+    
+    ShaderProgram *next = shaderLibrary.get(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, defines);
+    if (!next) {
+        debugUvWanted = debugUv;
+        return;
+    }
+    
+    shaderDefines = defines;
+    switchProgram(next);
+}
 
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+// the old programs stay in use until every permutation compiled and linked
+void reloadShaders()
+{
+    if (shaderWatcher.poll()) {
+        if (shaderLibrary.reloading())
+            reloadQueued = true;
+        else
+            shaderLibrary.beginReload();
+    }
+    
+    if (!shaderLibrary.reloading() || !shaderLibrary.reloadReady())
+        return;
+    
+    if (shaderLibrary.finishReload()) {
+        switchProgram(shaderLibrary.get(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, shaderDefines));
         
-        processInput(window);
+        // an edit may have added an include
+        for (const std::string &file : shaderLibrary.sourceFiles())
+            shaderWatcher.watch(file);
+        std::cout << "Reloaded shaders" << std::endl;
+    } else {
+        std::cout << "Shader reload failed, keeping the previous programs" << std::endl;
+    }
+    
+    if (reloadQueued) {
+        reloadQueued = false;
+        shaderLibrary.beginReload();
+    }
+}
+
+void drawInstanced(const std::vector<glm::mat4> &models)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    // orphan the previous frame's storage so the upload doesn't wait on the gpu
+    glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, models.size() * sizeof(glm::mat4), models.data());
+    
+    glDrawElementsInstanced(GL_TRIANGLES, meshIndexCount, meshIndexType, 0, models.size());
+}
+
+void drawLoop(const std::vector<glm::mat4> &models)
+{
+    for (const glm::mat4 &model : models) {
+        for (int i = 0; i < 4; i++)
+            glVertexAttrib4fv(imodel_location + i, &model[i][0]);
+        glDrawElements(GL_TRIANGLES, meshIndexCount, meshIndexType, 0);
+    }
+}
 
-        // === clear ==========================================        
+// the same instances at low resolution, writing the tiles each pixel wants
+void drawFeedback(const std::vector<glm::mat4> &models)
+{
+    ShaderProgram *feedback = shaderLibrary.get(VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH, FEEDBACK_DEFINES);
+    if (!feedback)
+        return;
+    
+    ShaderProgram *previous = program;
+    virtualTexture.beginFeedback();
+    switchProgram(feedback, true);
+    
+    // the instance buffer still holds this frame's matrices
+    if (params.instanced)
+        glDrawElementsInstanced(GL_TRIANGLES, meshIndexCount, meshIndexType, 0, models.size());
+    else
+        drawLoop(models);
+    
+    switchProgram(previous);
+    virtualTexture.endFeedback();
+}
+
+// camera, culling and instance matrices of one frame from the interpolated
+// simulation state, on the main thread
+void buildFrame(FramePacket &packet, const SimState &state)
+{
+    const glm::vec3 &cameraPos = state.cameraPos;
+    glm::mat4 projection = glm::perspective(glm::radians(fov), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    
+    CameraBlock &camera = packet.camera;
+    camera.view = view;
+    camera.projection = projection;
+    camera.viewProj = projection * view;
+    camera.cameraPos = glm::vec4(cameraPos, state.time);
+    
+    updateScene(state.time);
+    
+    // cull
+    Frustum frustum = extractFrustum(camera.viewProj);
+    
+    visibleCubes.clear();
+    switch (params.culling) {
+    case CullMode::Linear:
+        cullScene(frustum);
+        break;
+    case CullMode::Bvh:
+        refitScene();
+        sceneBvh.cull(frustum, visibleCubes);
+        break;
+    default:
+        for (uint32_t i = 0; i < scene.size(); i++)
+            visibleCubes.push_back(i);
+    }
+    
+    if (pickRequested) {
+        pickCube(camera.viewProj);
+        pickRequested = false;
+    }
+    
+    // draw submission, the visible world matrices in slot order
+    packet.instanceModels.resize(visibleCubes.size());
+    glm::mat4 *models = packet.instanceModels.data();
+    jobs.parallelFor(0, visibleCubes.size(), MODEL_GRAIN, [models](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            models[i] = scene.world(visibleCubes[i]) * meshMatrix;
+    });
+    
+    packet.debugUvToggles = debugUvToggles;
+    packet.viewportWidth = viewportWidth;
+    packet.viewportHeight = viewportHeight;
+}
+
+// owns the gl context from the first frame until close, draws whatever
+// frame the simulation published last
+void renderLoop()
+{
+    traceThreadName("render");
+    makeContextCurrent(true);
+    
+    unsigned int frame = 0;
+    unsigned int totalFrames = 0;
+    double drawTime[2] = { 0.0, 0.0 };  // loop, instanced
+    unsigned int layoutFrame = 0;
+    unsigned int debugUvApplied = 0;
+    int viewportApplied[2] = { 0, 0 };
+    
+    double runStart = getTime();
+    float lastStatsLog = 0.0f;
+    
+    for (;;)
+    {
+        {
+            TRACE_SCOPE("wait frame");
+            while (!closeRequested && !frameMailbox.acquire())
+                std::this_thread::yield();
+        }
+        if (closeRequested)
+            break;
+        
+        TRACE_SCOPE("frame");
+        profiler.beginFrame();
+        
+        const FramePacket &packet = frameMailbox.front();
+        float currentFrame = getTime();
         
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // === input ==========================================
+        {
+            ProfileScope scope(profiler, STAGE_INPUT);
+            TRACE_SCOPE("input");
+            
+            // key presses and resizes since the last frame that were handled on the main thread
+            for (; debugUvApplied != packet.debugUvToggles; debugUvApplied++)
+                toggleDebugUv();
+            updateDebugUv();
+            
+            if (packet.viewportWidth && (packet.viewportWidth != viewportApplied[0] || packet.viewportHeight != viewportApplied[1])) {
+                glViewport(0, 0, packet.viewportWidth, packet.viewportHeight);
+                viewportApplied[0] = packet.viewportWidth;
+                viewportApplied[1] = packet.viewportHeight;
+            }
+            
+            reloadShaders();
+        }
         
-        glBindTexture(GL_TEXTURE_2D, texture);
+        // === clear ==========================================
+        {
+            ProfileScope scope(profiler, STAGE_CLEAR);
+            TRACE_SCOPE("clear");
+            
+            glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            
+            // both upload through unit 0, bind for drawing afterwards
+            textureLoader.update();
+            if (virtualTextured)
+                virtualTexture.update();
+            
+            glBindTexture(GL_TEXTURE_2D, texture);
+            if (virtualTextured)
+                virtualTexture.bind(1, 2);
+        }
         
         // === transform ======================================
+        {
+            ProfileScope scope(profiler, STAGE_TRANSFORM);
+            TRACE_SCOPE("transform");
+            
+            // on a failed map the previous frame's camera stays bound
+            if (void *block = cameraRing.begin()) {
+                memcpy(block, &packet.camera, sizeof(packet.camera));
+                cameraRing.end(CAMERA_BLOCK_BINDING);
+            }
+        }
         
-        glm::mat4 projection = glm::perspective(glm::radians(fov), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        glm::mat4 model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        model = glm::translate(model, glm::vec3(0.0f,  0.0f,  0.0f));
+        // === draw ===========================================
+        {
+            ProfileScope scope(profiler, STAGE_DRAW);
+            TRACE_SCOPE("draw");
+            double drawStart = getTime();
+            
+            if (params.instanced)
+                drawInstanced(packet.instanceModels);
+            else
+                drawLoop(packet.instanceModels);
+            
+            drawTime[params.instanced] += getTime() - drawStart;
+            
+            if (virtualTextured)
+                drawFeedback(packet.instanceModels);
+            
+            cameraRing.fence();
+        }
+        
+        // === swap ===========================================
+        {
+            ProfileScope scope(profiler, STAGE_SWAP);
+            TRACE_SCOPE("swap");
+            
+            if (window)
+                glfwSwapBuffers(window);
+        }
         
-        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, &projection[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, &view[0][0]);
+        profiler.endFrame();
+        
+        if (params.statsInterval > 0.0f && currentFrame - lastStatsLog >= params.statsInterval) {
+            profiler.log();
+            lastStatsLog = currentFrame;
+        }
+        
+        // === benchmark ======================================
+        
+        if (params.benchmarkFrames && ++frame == params.benchmarkFrames) {
+            if (!params.instanced) {
+                setInstanced(true);
+                frame = 0;
+            } else {
+                std::cout << "draw benchmark, " << scene.size() << " cubes ("
+                          << packet.instanceModels.size() << " visible), "
+                          << params.benchmarkFrames << " frames" << std::endl;
+                std::cout << "  loop:      " << drawTime[0] * 1000.0 / params.benchmarkFrames << " ms/frame" << std::endl;
+                std::cout << "  instanced: " << drawTime[1] * 1000.0 / params.benchmarkFrames << " ms/frame" << std::endl;
+                requestClose();
+            }
+        }
+        
+        if (params.layoutBenchmarkFrames && ++layoutFrame == params.layoutBenchmarkFrames) {
+            StageStats cpu = profiler.cpuStats(STAGE_DRAW);
+            StageStats gpu = profiler.gpuStats(STAGE_DRAW);
+            // vertex fetch only, the instance matrices are the same for every layout
+            double bytes = double(packet.instanceModels.size()) * meshVertexCount * meshLayout.stride;
+            
+            std::cout << "  " << formatName(params.vertexFormat) << " (" << meshLayout.stride << " B): cpu "
+                      << cpu.avg << " ms, gpu " << gpu.avg << " ms, ";
+            if (gpu.avg > 0.0)
+                std::cout << bytes / (gpu.avg * 1e6) << " GB/s vertex fetch" << std::endl;
+            else
+                std::cout << "no gpu timing" << std::endl;
+            
+            if (params.vertexFormat == VertexFormat::Packed) {
+                requestClose();
+            } else {
+                params.vertexFormat = params.vertexFormat == VertexFormat::Float ? VertexFormat::Compact : VertexFormat::Packed;
+                uploadCube(params.vertexFormat);
+                profiler.reset();
+                layoutFrame = 0;
+            }
+        }
+        
+        if (params.frames && ++totalFrames == params.frames)
+            requestClose();
+    }
+    
+    if (params.frames) {
+        // wait for the gpu so the total covers every frame that was submitted
+        glFinish();
+        double total = getTime() - runStart;
+        std::cout << totalFrames << " frames in " << total << " s, "
+                  << total * 1000.0 / totalFrames << " ms/frame" << std::endl;
+        profiler.log();
+        if (virtualTextured)
+            virtualTexture.report();
+    }
+    
+    makeContextCurrent(false);
+}
 
+void oglRun() {
+    if (params.benchmarkFrames)
+        setInstanced(false);
+    else
+        setInstanced(params.instanced);
+    
+    if (params.layoutBenchmarkFrames) {
+        if (!params.modelPath.empty()) {
+            std::cout << "layout benchmark only runs on the built-in cube" << std::endl;
+            params.layoutBenchmarkFrames = 0;
+        } else {
+            std::cout << "layout benchmark, " << scene.size() << " cubes, "
+                      << params.layoutBenchmarkFrames << " frames" << std::endl;
+            params.vertexFormat = VertexFormat::Float;
+            uploadCube(params.vertexFormat);
+            profiler.reset();
+        }
+    }
+    
+    // the render thread owns the context until it stops, events and
+    // simulation stay here so a swap blocked on vsync doesn't stall them
+    makeContextCurrent(false);
+    std::thread renderThread(renderLoop);
+    
+    // runs that stop on their own take exactly one step per frame, so they
+    // draw the same frames every time
+    double step = 1.0 / std::max(params.simulationHz, 1.0f);
+    bool fixedFrames = params.frames || params.benchmarkFrames || params.layoutBenchmarkFrames;
+    double lastTime = getTime();
+    
+    while (!shouldClose())
+    {
+        TRACE_SCOPE("simulate");
         
-        // === transform ======================================
+        if (window) {
+            glfwPollEvents();
+            processInput(window);
+        }
         
-        // glDrawElements(GL_TRIANGLES, sizeof(indices), GL_UNSIGNED_INT, 0);
-        // glDrawArrays(GL_TRIANGLES, 0, 36); // sizeof(indices));
+        double now = getTime();
+        simAccumulator += fixedFrames ? step : std::min(now - lastTime, MAX_FRAME_TIME);
+        lastTime = now;
         
-        for (unsigned int i = 0; i < 10; i++) {
-            // calculate the model matrix for each object and pass it to shader before drawing
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePositions[i]);
-            model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.5f, 1.0f, 0.0f));
-            glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
-
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        while (simAccumulator >= step) {
+            TRACE_SCOPE("step");
+            simPrevious = simCurrent;
+            stepSimulation(simCurrent, step);
+            simAccumulator -= step;
         }
         
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-    }    
+        // draw the state part of a step behind, between the last two steps
+        float alpha = simAccumulator / step;
+        SimState state;
+        state.cameraPos = glm::mix(simPrevious.cameraPos, simCurrent.cameraPos, alpha);
+        state.time = simPrevious.time + (simCurrent.time - simPrevious.time) * alpha;
+        
+        buildFrame(frameMailbox.back(), state);
+        
+        // one frame ahead of the renderer at most, keep handling events meanwhile
+        while (frameMailbox.pending() && !shouldClose()) {
+            if (window)
+                glfwWaitEventsTimeout(0.001);
+            else
+                std::this_thread::yield();
+        }
+        frameMailbox.publish();
+    }
+    
+    requestClose();
+    renderThread.join();
+    makeContextCurrent(true);
 }
 
-OGLRenderer::OGLRenderer() {
+OGLRenderer::OGLRenderer(const RendererParams &rendererParams) {
+    params = rendererParams;
     oglRenderer();
 }
 
@@ -1,7 +1,45 @@
+#pragma once
+
+#include <string>
+
+enum class CullMode
+{
+    None,
+    Linear,     // simd test of every cube's bounds
+    Bvh         // hierarchy refit every frame, also used for picking
+};
+
+enum class VertexFormat
+{
+    Float,      // 32 bytes, float position, color and uv
+    Compact,    // 20 bytes, the unused color dropped
+    Packed      // 12 bytes, half position and unorm16 uv
+};
+
+struct RendererParams
+{
+    unsigned int cubeCount = 10;        // cubes in the scene, extra ones are scattered around the first ten
+    bool instanced = true;              // one instanced draw instead of a draw per cube
+    CullMode culling = CullMode::Linear;    // how cubes outside the view frustum are skipped
+    unsigned int benchmarkFrames = 0;   // if set, time this many frames per draw mode and exit
+    VertexFormat vertexFormat = VertexFormat::Packed;  // cube vertex layout, models always use the cache's
+    unsigned int layoutBenchmarkFrames = 0; // if set, time this many frames per vertex format and exit
+    bool headless = false;              // render offscreen through EGL, no window or input
+    unsigned int frames = 0;            // stop after this many frames, 0 runs until closed
+    float statsInterval = 0.0f;         // seconds between frame timing logs, 0 disables them
+    std::string modelPath;              // model drawn instead of the cube, imported once into a cache
+    std::string tracePath;              // record a chrome trace, written on exit and when T is pressed
+    bool compressTextures = true;       // cook textures to bc1/bc3, otherwise keep raw mip levels
+    std::string virtualTexturePath;     // image streamed in tiles instead of the regular texture
+    unsigned int virtualTexturePages = 64;  // tiles the virtual texture keeps resident
+    unsigned int jobThreads = 0;        // threads culling and building instances, 0 uses every core
+    float simulationHz = 60.0f;         // fixed simulation rate, frames interpolate between steps
+};
+
 class OGLRenderer
 {
 public:
-    OGLRenderer();
+    OGLRenderer(const RendererParams &params = RendererParams());
     ~OGLRenderer();
     void run();
 };
@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "program_cache.h"
+#include "trace.h"
+
+std::string programCacheDir = "shadercache";
+
+// GLAD_GL_ARB_get_program_binary, if glad knew about extensions
+static bool arbGetProgramBinary = false;
+
+struct ProgramBinaryHeader
+{
+    char magic[4];          // "GTPB"
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;        // binaryFormat from glGetProgramBinary
+    uint32_t length;
+};
+
+static const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+static void hashBytes(uint64_t &hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+}
+
+static std::string cachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+    return programCacheDir + "/" + name;
+}
+
+void loadProgramBinaryExtension(GLADloadproc load)
+{
+    arbGetProgramBinary = false;
+    if (GLAD_GL_VERSION_4_1)
+        return;
+    
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        if (!strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), "GL_ARB_get_program_binary")) {
+            // core entry points without a suffix, the same ones 4.1 has
+            glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC) load("glGetProgramBinary");
+            glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC) load("glProgramBinary");
+            glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC) load("glProgramParameteri");
+            arbGetProgramBinary = glad_glGetProgramBinary && glad_glProgramBinary && glad_glProgramParameteri;
+            return;
+        }
+    }
+}
+
+bool programBinariesSupported()
+{
+    if (!GLAD_GL_VERSION_4_1 && !arbGetProgramBinary)
+        return false;
+    
+    // a driver may expose the entry points with no formats to back them
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t programCacheKey(const std::vector<std::string> &sources)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hashBytes(hash, &PROGRAM_CACHE_VERSION, sizeof(PROGRAM_CACHE_VERSION));
+    
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char *value = (const char*) glGetString(name);
+        if (value)
+            hashBytes(hash, value, strlen(value) + 1);
+    }
+    
+    // the size keeps "ab" + "c" apart from "a" + "bc"
+    for (const std::string &source : sources) {
+        uint64_t size = source.size();
+        hashBytes(hash, &size, sizeof(size));
+        hashBytes(hash, source.data(), source.size());
+    }
+    
+    return hash;
+}
+
+bool loadProgramBinary(uint64_t key, GLuint &program)
+{
+    TRACE_SCOPE("load program binary");
+    
+    if (!programBinariesSupported())
+        return false;
+    
+    std::string path = cachePath(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    
+    ProgramBinaryHeader header;
+    if (!file.read((char*) &header, sizeof(header))
+        || memcmp(header.magic, "GTPB", 4)
+        || header.version != PROGRAM_CACHE_VERSION
+        || header.key != key)
+        return false;
+    
+    // the length sizes the read buffer, a corrupt one must not get that far
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if (error || size - sizeof(header) != header.length) {
+        file.close();
+        std::remove(path.c_str());
+        return false;
+    }
+    
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size()))
+        return false;
+    
+    program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+    
+    // drivers reject binaries from other builds here, even with identical strings
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        program = 0;
+        std::remove(path.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+bool saveProgramBinary(uint64_t key, GLuint program)
+{
+    TRACE_SCOPE("save program binary");
+    
+    if (!programBinariesSupported())
+        return false;
+    
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+    
+    ProgramBinaryHeader header = {};
+    memcpy(header.magic, "GTPB", 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.length = length;
+    
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+    header.format = format;
+    
+    std::error_code error;
+    std::filesystem::create_directories(programCacheDir, error);
+    
+    // same temporary name dance as the mesh cache, a torn file never gets loaded
+    std::string path = cachePath(key);
+    std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write((const char*) &header, sizeof(header));
+    file.write(binary.data(), binary.size());
+    file.close();
+    
+    if (!file) {
+        std::cout << "ERROR::PROGRAM::CACHE_NOT_WRITABLE\n" << path << std::endl;
+        return false;
+    }
+    
+    std::remove(path.c_str());
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad.h>
+
+// Linked program binaries kept on disk ("shadercache/<key>.bin") so later
+// runs skip compiling and linking. The key covers the shader sources and
+// the driver's vendor, renderer and version strings, a driver update or an
+// edited shader just misses the cache. Needs GL 4.1 or
+// ARB_get_program_binary, without it every lookup misses.
+
+extern std::string programCacheDir;
+
+// glad here is generated without extensions, call right after loading it
+// so contexts older than 4.1 pick up the ARB_get_program_binary entry points
+void loadProgramBinaryExtension(GLADloadproc load);
+bool programBinariesSupported();
+
+uint64_t programCacheKey(const std::vector<std::string> &sources);
+
+// creates and links program from the cached binary, false on any mismatch
+bool loadProgramBinary(uint64_t key, GLuint &program);
+bool saveProgramBinary(uint64_t key, GLuint program);
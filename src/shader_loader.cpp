@@ -1,24 +1,38 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
 
 #include <glm.hpp>
 
+#include "program_cache.h"
+#include "shader_preprocessor.h"
 #include "shader_loader.h"
+#include "trace.h"
 
-int load_shader(
-    GLuint &shader,
-    GLenum shader_type,
-    std::string shader_text,
-    std::string error_str)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// compiles without asking for the status, which would wait for the compiler
+GLuint submit_shader(GLenum shader_type, const std::string &shader_text)
 {
-    int  success;
-    char infoLog[512];
+    TRACE_SCOPE("compile shader");
     
-    shader = glCreateShader(shader_type);
+    GLuint shader = glCreateShader(shader_type);
     const char *c_str = shader_text.c_str();
     glShaderSource(shader, 1, &c_str, NULL);
     glCompileShader(shader);
+    return shader;
+}
+
+bool check_shader(GLuint shader, const char *error_str)
+{
+    int  success;
+    char infoLog[512];
     
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success)
@@ -27,41 +41,29 @@ int load_shader(
         std::cout << error_str << infoLog << std::endl;
     }
     
-    return success;
-}
-
-bool load_vertex_shader(GLuint &shader, const char* shader_text)
-{
-    int success = load_shader(
-        shader,
-        GL_VERTEX_SHADER,
-        shader_text,
-        "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n");
-        
-    return success ? true : false;
-}
-
-bool load_fragment_shader(GLuint &shader, const char* shader_text)
-{
-    int success = load_shader(
-        shader,
-        GL_FRAGMENT_SHADER,
-        shader_text,
-        "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n");
-        
     return success ? true : false;
 }
 
-bool load_program(GLuint &program, GLuint vertex_shader, GLuint fragment_shader)
+// linking an uncompiled shader is fine, the driver waits for it on its own threads
+GLuint submit_program(GLuint vertex_shader, GLuint fragment_shader)
 {
-    program = glCreateProgram();
+    TRACE_SCOPE("link program");
+    
+    GLuint program = glCreateProgram();
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
+    // lets the program cache read the binary back
+    if (programBinariesSupported())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
+    return program;
+}
 
+bool check_program(GLuint program)
+{
     int  success;
     char infoLog[512];
-    glGetShaderiv(program, GL_LINK_STATUS, &success);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (!success)
     {
         glGetProgramInfoLog(program, 512, NULL, infoLog);
@@ -71,59 +73,625 @@ bool load_program(GLuint &program, GLuint vertex_shader, GLuint fragment_shader)
     return success ? true : false;
 }
 
-bool makeProgramm(
-    GLuint &program,
-    const char* vertex_shader_src,
-    const char* fragment_shader_src)
+// "vertex.glsl + fragment.glsl [A, B=1]" for logs
+static std::string programName(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    std::string name = vertexPath + " + " + fragmentPath;
+    for (size_t i = 0; i < defines.size(); i++)
+        name += (i ? ", " : " [") + defines[i];
+    return defines.empty() ? name : name + "]";
+}
+
+// === batch ==========================================
+// not in the generated glad, both extensions share the signature
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+static bool parallelCompile = false;
+
+void ProgramBatch::init(GLADloadproc load)
+{
+    const char *extension = nullptr;
+    const char *function = nullptr;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count && !extension; i++) {
+        const char *name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        if (!strcmp(name, "GL_KHR_parallel_shader_compile")) {
+            extension = name;
+            function = "glMaxShaderCompilerThreadsKHR";
+        } else if (!strcmp(name, "GL_ARB_parallel_shader_compile")) {
+            extension = name;
+            function = "glMaxShaderCompilerThreadsARB";
+        }
+    }
+    
+    parallelCompile = extension != nullptr;
+    if (!parallelCompile) {
+        std::cout << "No parallel shader compile, programs build on the render thread when finished" << std::endl;
+        return;
+    }
+    
+    // some drivers only start compiler threads once asked to, all of them is 0xffffffff
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) load(function);
+    if (maxShaderCompilerThreads)
+        maxShaderCompilerThreads(0xffffffff);
+    std::cout << "Parallel shader compile with " << extension << std::endl;
+}
+
+bool ProgramBatch::parallelCompileSupported()
+{
+    return parallelCompile;
+}
+
+size_t ProgramBatch::add(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    std::string vertexCode, fragmentCode;
+    std::vector<std::string> vertexFiles, fragmentFiles;
+    if (!preprocessShader(vertexPath, defines, vertexCode, vertexFiles)
+        || !preprocessShader(fragmentPath, defines, fragmentCode, fragmentFiles)) {
+        programs.emplace_back();
+        programs.back().failed = true;
+        return programs.size() - 1;
+    }
+    
+    vertexFiles.insert(vertexFiles.end(), fragmentFiles.begin(), fragmentFiles.end());
+    return addSource(programName(vertexPath, fragmentPath, defines), vertexCode, fragmentCode, vertexFiles);
+}
+
+size_t ProgramBatch::addSource(
+    const std::string &name,
+    const std::string &vertexCode,
+    const std::string &fragmentCode,
+    const std::vector<std::string> &files)
 {
-    GLuint vertex_shader, fragment_shader;
+    TRACE_SCOPE("submit program");
+    
+    programs.emplace_back();
+    Pending &pending = programs.back();
+    pending.name = name;
+    pending.files = files;
+    pending.start = std::chrono::steady_clock::now();
+    
+    // binaries load synchronously but there's nothing to compile
+    pending.key = programCacheKey({ vertexCode, fragmentCode });
+    pending.cached = loadProgramBinary(pending.key, pending.program);
+    if (!pending.cached) {
+        pending.vertexShader = submit_shader(GL_VERTEX_SHADER, vertexCode);
+        pending.fragmentShader = submit_shader(GL_FRAGMENT_SHADER, fragmentCode);
+        pending.program = submit_program(pending.vertexShader, pending.fragmentShader);
+    }
     
-    if (!load_vertex_shader(vertex_shader, vertex_shader_src))
+    return programs.size() - 1;
+}
+
+bool ProgramBatch::ready(size_t index) const
+{
+    const Pending &pending = programs[index];
+    if (pending.failed || pending.finished || !parallelCompile)
+        return true;
+    
+    GLint done = GL_FALSE;
+    glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+bool ProgramBatch::finish(size_t index, GLuint &program)
+{
+    TRACE_SCOPE("finish program");
+    
+    Pending &pending = programs[index];
+    if (pending.failed)
         return false;
+    if (pending.finished) {
+        program = pending.program;
+        return true;
+    }
     
-    if (!load_fragment_shader(fragment_shader, fragment_shader_src))
+    auto waitStart = std::chrono::steady_clock::now();
+    
+    if (!pending.cached) {
+        // compile errors first, the link log would only say a shader didn't compile
+        bool compiled = check_shader(pending.vertexShader, "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n")
+                      & check_shader(pending.fragmentShader, "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n");
+        bool linked = compiled && check_program(pending.program);
+        
+        glDetachShader(pending.program, pending.vertexShader);
+        glDetachShader(pending.program, pending.fragmentShader);
+        glDeleteShader(pending.vertexShader);
+        glDeleteShader(pending.fragmentShader);
+        
+        if (!linked || !compiled) {
+            glDeleteProgram(pending.program);
+            pending.failed = true;
+            return false;
+        }
+        
+        saveProgramBinary(pending.key, pending.program);
+    }
+    
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - pending.start).count();
+    double waited = std::chrono::duration<double, std::milli>(end - waitStart).count();
+    std::cout << (pending.cached ? "Loaded cached program " : "Compiled program ")
+              << pending.name << " in " << ms << " ms ("
+              << waited << " ms waiting" << (parallelCompile ? ", parallel" : "") << ")" << std::endl;
+    
+    pending.finished = true;
+    program = pending.program;
+    return true;
+}
+
+void ProgramBatch::discard(size_t index)
+{
+    Pending &pending = programs[index];
+    if (pending.failed || pending.finished)
+        return;
+    
+    // deleting doesn't wait, the driver drops whatever it was still building
+    if (!pending.cached) {
+        glDeleteShader(pending.vertexShader);
+        glDeleteShader(pending.fragmentShader);
+    }
+    glDeleteProgram(pending.program);
+    pending.failed = true;
+}
+
+bool ProgramBatch::finish(size_t index, ShaderProgram &program)
+{
+    GLuint id;
+    if (!finish(index, id))
         return false;
+    
+    return program.reflect(id);
+}
 
-    if (!load_program(program, vertex_shader, fragment_shader))
+bool getProgram(std::string vertexPath, std::string fragmentPath, GLuint &program) {
+    TRACE_SCOPE("getProgram");
+    
+    ProgramBatch batch;
+    return batch.finish(batch.add(vertexPath, fragmentPath), program);
+}
+
+bool getProgram(std::string vertexPath, std::string fragmentPath, ShaderProgram &program)
+{
+    GLuint id;
+    if (!getProgram(vertexPath, fragmentPath, id))
         return false;
     
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader); 
+    return program.reflect(id);
+}
+
+// === library ========================================
+uint64_t ShaderLibrary::permutationKey(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    std::vector<std::string> defines)
+{
+    // the order defines are listed in doesn't make a different permutation
+    std::sort(defines.begin(), defines.end());
     
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const std::string &text) {
+        for (char c : text)
+            hash = (hash ^ (uint8_t) c) * 1099511628211ull;
+        hash = (hash ^ 0xff) * 1099511628211ull;   // separator, no byte of a path or define
+    };
+    add(vertexPath);
+    add(fragmentPath);
+    for (const std::string &define : defines)
+        add(define);
+    return hash;
+}
+
+static void addFile(std::vector<std::string> &files, const std::string &file)
+{
+    if (std::find(files.begin(), files.end(), file) == files.end())
+        files.push_back(file);
+}
+
+void ShaderLibrary::submit(
+    Set &set,
+    uint64_t permutation,
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    TRACE_SCOPE("request permutation");
+    
+    std::string vertexCode, fragmentCode;
+    std::vector<std::string> vertexFiles, fragmentFiles;
+    if (!preprocessShader(vertexPath, defines, vertexCode, vertexFiles)
+        || !preprocessShader(fragmentPath, defines, fragmentCode, fragmentFiles)) {
+        return;
+    }
+    
+    for (const std::string &file : vertexFiles)
+        addFile(set.files, file);
+    for (const std::string &file : fragmentFiles)
+        addFile(set.files, file);
+    
+    // a define no shader tests gives the same source, no need for a second program
+    uint64_t source = programCacheKey({ vertexCode, fragmentCode });
+    set.permutations[permutation] = { vertexPath, fragmentPath, defines, source };
+    if (set.programs.count(source))
+        return;
+    
+    vertexFiles.insert(vertexFiles.end(), fragmentFiles.begin(), fragmentFiles.end());
+    Entry &entry = set.programs[source];
+    entry.batchIndex = set.batch.addSource(programName(vertexPath, fragmentPath, defines),
+                                           vertexCode, fragmentCode, vertexFiles);
+}
+
+bool ShaderLibrary::finish(Set &set, Entry &entry)
+{
+    if (!entry.program && !entry.failed) {
+        std::unique_ptr<ShaderProgram> program(new ShaderProgram());
+        if (set.batch.finish(entry.batchIndex, *program))
+            entry.program = std::move(program);
+        else
+            entry.failed = true;
+    }
+    return !entry.failed;
+}
+
+void ShaderLibrary::destroy(Set &set)
+{
+    // requested permutations nobody fetched are still in the batch
+    for (auto &source : set.programs) {
+        if (source.second.program)
+            source.second.program->destroy();
+        else
+            set.batch.discard(source.second.batchIndex);
+    }
+    set = Set();
+}
+
+void ShaderLibrary::request(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    uint64_t permutation = permutationKey(vertexPath, fragmentPath, defines);
+    if (!current.permutations.count(permutation))
+        submit(current, permutation, vertexPath, fragmentPath, defines);
+    // a reload in flight has to come back with this one too
+    if (reloadPending && !next.permutations.count(permutation))
+        submit(next, permutation, vertexPath, fragmentPath, defines);
+}
+
+bool ShaderLibrary::ready(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    request(vertexPath, fragmentPath, defines);
+    
+    auto permutation = current.permutations.find(permutationKey(vertexPath, fragmentPath, defines));
+    if (permutation == current.permutations.end())
+        return true;    // didn't preprocess, get() fails right away
+    
+    const Entry &entry = current.programs[permutation->second.source];
+    return entry.program || entry.failed || current.batch.ready(entry.batchIndex);
+}
+
+ShaderProgram* ShaderLibrary::get(
+    const std::string &vertexPath,
+    const std::string &fragmentPath,
+    const std::vector<std::string> &defines)
+{
+    request(vertexPath, fragmentPath, defines);
+    
+    auto permutation = current.permutations.find(permutationKey(vertexPath, fragmentPath, defines));
+    if (permutation == current.permutations.end())
+        return nullptr;
+    
+    Entry &entry = current.programs[permutation->second.source];
+    finish(current, entry);
+    return entry.program.get();
+}
+
+void ShaderLibrary::beginReload()
+{
+    destroy(next);
+    for (const auto &permutation : current.permutations) {
+        const Permutation &p = permutation.second;
+        submit(next, permutation.first, p.vertexPath, p.fragmentPath, p.defines);
+    }
+    reloadPending = true;
+}
+
+bool ShaderLibrary::reloadReady() const
+{
+    for (const auto &source : next.programs) {
+        const Entry &entry = source.second;
+        if (!entry.program && !entry.failed && !next.batch.ready(entry.batchIndex))
+            return false;
+    }
     return true;
 }
 
-bool getProgram(std::string vertexPath, std::string fragmentPath, GLuint &program) {
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-    // ensure ifstream objects can throw exceptions:
-    vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-    try 
-    {
-        // open files
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-        std::stringstream vShaderStream, fShaderStream;
-        // read file's buffer contents into streams
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-        // close file handlers
-        vShaderFile.close();
-        fShaderFile.close();
-        // convert stream into string
-        vertexCode = vShaderStream.str();
-        fragmentCode = fShaderStream.str();			
-        // if geometry shader path is present, also load a geometry shader
-    }
-    catch (std::ifstream::failure e)
-    {
-        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+bool ShaderLibrary::finishReload()
+{
+    reloadPending = false;
+    
+    // a permutation that no longer preprocesses counts as failed too
+    bool built = true;
+    for (const auto &permutation : current.permutations)
+        built = built && next.permutations.count(permutation.first);
+    for (auto &source : next.programs)
+        built = finish(next, source.second) && built;
+    
+    if (!built) {
+        destroy(next);
+        return false;
+    }
+    
+    destroy(replaced);
+    replaced = std::move(current);
+    current = std::move(next);
+    next = Set();
+    return true;
+}
+
+void ShaderLibrary::clear()
+{
+    destroy(current);
+    destroy(next);
+    destroy(replaced);
+    reloadPending = false;
+}
+
+// size of a uniform value in 32-bit words
+static unsigned int uniformWords(GLenum type)
+{
+    switch (type) {
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+        return 2;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+        return 3;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_FLOAT_MAT2:
+        return 4;
+    case GL_FLOAT_MAT3:
+        return 9;
+    case GL_FLOAT_MAT4:
+        return 16;
+    default:
+        return 1;   // scalars, bools and samplers
+    }
+}
+
+static bool byHash(const ShaderProgram::Variable &a, const ShaderProgram::Variable &b)
+{
+    return a.hash < b.hash;
+}
+
+static const ShaderProgram::Variable* findVariable(
+    const std::vector<ShaderProgram::Variable> &variables,
+    uint32_t name)
+{
+    ShaderProgram::Variable key = {};
+    key.hash = name;
+    auto it = std::lower_bound(variables.begin(), variables.end(), key, byHash);
+    if (it == variables.end() || it->hash != name)
+        return nullptr;
+    return &*it;
+}
+
+// fills variables from GL_ACTIVE_UNIFORMS or GL_ACTIVE_ATTRIBUTES
+static bool reflectVariables(
+    GLuint program,
+    bool uniforms,
+    std::vector<ShaderProgram::Variable> &variables,
+    unsigned int &cacheWords)
+{
+    GLint count = 0;
+    GLint maxLength = 0;
+    glGetProgramiv(program, uniforms ? GL_ACTIVE_UNIFORMS : GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(program, uniforms ? GL_ACTIVE_UNIFORM_MAX_LENGTH : GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    
+    std::vector<char> name(std::max(maxLength, 1));
+    variables.clear();
+    
+    for (GLint i = 0; i < count; i++) {
+        ShaderProgram::Variable var = {};
+        GLsizei length = 0;
+        if (uniforms)
+            glGetActiveUniform(program, i, name.size(), &length, &var.size, &var.type, name.data());
+        else
+            glGetActiveAttrib(program, i, name.size(), &length, &var.size, &var.type, name.data());
+        
+        var.location = uniforms
+            ? glGetUniformLocation(program, name.data())
+            : glGetAttribLocation(program, name.data());
+        if (var.location < 0)
+            continue;   // block members and built-ins
+        
+        // arrays are reported as "name[0]", look them up by the bare name
+        if (length > 3 && !strcmp(name.data() + length - 3, "[0]"))
+            name[length - 3] = '\0';
+        
+        var.hash = hashName(name.data());
+        if (findVariable(variables, var.hash)) {
+            std::cout << "ERROR::PROGRAM::NAME_HASH_COLLISION\n" << name.data() << std::endl;
+            return false;
+        }
+        
+        if (uniforms) {
+            var.cacheOffset = cacheWords;
+            cacheWords += uniformWords(var.type) * var.size;
+        }
+        
+        variables.insert(std::upper_bound(variables.begin(), variables.end(), var, byHash), var);
+    }
+    
+    return true;
+}
+
+bool ShaderProgram::reflect(GLuint id)
+{
+    program = id;
+    
+    unsigned int cacheWords = 0;
+    if (!reflectVariables(program, true, uniforms, cacheWords)
+        || !reflectVariables(program, false, attributes, cacheWords)) {
+        destroy();
         return false;
     }
     
-    return makeProgramm(program, vertexCode.c_str(), fragmentCode.c_str());
+    values.assign(cacheWords, 0);
+    return true;
+}
+
+void ShaderProgram::destroy()
+{
+    glDeleteProgram(program);
+    program = 0;
+    uniforms.clear();
+    attributes.clear();
+    values.clear();
+}
+
+GLint ShaderProgram::uniformLocation(uint32_t name) const
+{
+    const Variable *var = findVariable(uniforms, name);
+    return var ? var->location : -1;
+}
+
+GLint ShaderProgram::attribLocation(uint32_t name) const
+{
+    const Variable *var = findVariable(attributes, name);
+    return var ? var->location : -1;
+}
+
+bool ShaderProgram::bindUniformBlock(const char *name, GLuint binding) const
+{
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index == GL_INVALID_INDEX)
+        return false;
+    
+    glUniformBlockBinding(program, index, binding);
+    return true;
 }
 
+// glUniform1i is how bools and samplers are set too
+static bool isIntegerScalar(GLenum type)
+{
+    switch (type) {
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_1D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_1D_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_2D_RECT:
+    case GL_SAMPLER_2D_RECT_SHADOW:
+    case GL_SAMPLER_BUFFER:
+    case GL_SAMPLER_2D_MULTISAMPLE:
+    case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_INT_SAMPLER_1D:
+    case GL_INT_SAMPLER_2D:
+    case GL_INT_SAMPLER_3D:
+    case GL_INT_SAMPLER_CUBE:
+    case GL_INT_SAMPLER_1D_ARRAY:
+    case GL_INT_SAMPLER_2D_ARRAY:
+    case GL_INT_SAMPLER_2D_RECT:
+    case GL_INT_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_1D:
+    case GL_UNSIGNED_INT_SAMPLER_2D:
+    case GL_UNSIGNED_INT_SAMPLER_3D:
+    case GL_UNSIGNED_INT_SAMPLER_CUBE:
+    case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+    case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// a setter that doesn't match the uniform type is ignored: GL would reject
+// the upload, and the cache would keep a value that never reached the program
+ShaderProgram::Variable* ShaderProgram::findUniform(uint32_t name, GLenum type)
+{
+    Variable *var = const_cast<Variable*>(findVariable(uniforms, name));
+    if (!var)
+        return nullptr;
+    if (type == GL_INT ? !isIntegerScalar(var->type) : var->type != type)
+        return nullptr;
+    return var;
+}
+
+// true if the value differs from the last upload and has to be sent
+template <typename T>
+static bool updateCache(ShaderProgram::Variable *var, uint32_t *cache, const T &value)
+{
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0, "uniform values are made of 32-bit words");
+    
+    if (!var)
+        return false;
+    
+    cache += var->cacheOffset;
+    if (var->cached && !memcmp(cache, &value, sizeof(T)))
+        return false;
+    
+    memcpy(cache, &value, sizeof(T));
+    var->cached = true;
+    return true;
+}
+
+void ShaderProgram::set(uint32_t name, int value)
+{
+    Variable *var = findUniform(name, GL_INT);
+    if (updateCache(var, values.data(), value))
+        glUniform1i(var->location, value);
+}
+
+void ShaderProgram::set(uint32_t name, float value)
+{
+    Variable *var = findUniform(name, GL_FLOAT);
+    if (updateCache(var, values.data(), value))
+        glUniform1f(var->location, value);
+}
+
+void ShaderProgram::set(uint32_t name, const glm::vec3 &value)
+{
+    Variable *var = findUniform(name, GL_FLOAT_VEC3);
+    if (updateCache(var, values.data(), value))
+        glUniform3fv(var->location, 1, &value[0]);
+}
+
+void ShaderProgram::set(uint32_t name, const glm::vec4 &value)
+{
+    Variable *var = findUniform(name, GL_FLOAT_VEC4);
+    if (updateCache(var, values.data(), value))
+        glUniform4fv(var->location, 1, &value[0]);
+}
+
+void ShaderProgram::set(uint32_t name, const glm::mat4 &value)
+{
+    Variable *var = findUniform(name, GL_FLOAT_MAT4);
+    if (updateCache(var, values.data(), value))
+        glUniformMatrix4fv(var->location, 1, GL_FALSE, &value[0][0]);
+}
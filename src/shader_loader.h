@@ -1,5 +1,185 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <glad.h>
+#include <glm.hpp>
+
+// FNV-1a, constexpr so uniform and attribute names hash at compile time
+constexpr uint32_t hashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+        hash = (hash ^ (uint8_t) *name++) * 16777619u;
+    return hash;
+}
+
+// Linked program with its active uniforms and attributes reflected once.
+// Setters upload to the current program and skip values that didn't change.
+class ShaderProgram
+{
+public:
+    struct Variable
+    {
+        uint32_t hash;
+        GLint location;
+        GLenum type;
+        GLint size;
+        unsigned int cacheOffset;   // first word of the last uploaded value
+        bool cached;
+    };
+    
+    // takes ownership of program, deletes it if reflection fails
+    bool reflect(GLuint program);
+    void destroy();
+    
+    GLuint id() const { return program; }
+    void use() const { glUseProgram(program); }
+    
+    GLint uniformLocation(uint32_t name) const;
+    GLint attribLocation(uint32_t name) const;
+    bool bindUniformBlock(const char *name, GLuint binding) const;
+    
+    void set(uint32_t name, int value);
+    void set(uint32_t name, float value);
+    void set(uint32_t name, const glm::vec3 &value);
+    void set(uint32_t name, const glm::vec4 &value);
+    void set(uint32_t name, const glm::mat4 &value);
+
+private:
+    Variable* findUniform(uint32_t name, GLenum type);
+    
+    GLuint program = 0;
+    std::vector<Variable> uniforms;     // sorted by hash
+    std::vector<Variable> attributes;   // sorted by hash
+    std::vector<uint32_t> values;
+};
+
+// Programs added to a batch are compiled and linked right away without any
+// status query, which would make the driver finish them on the spot. With
+// KHR_parallel_shader_compile the driver works through them on its own
+// threads meanwhile. finish() is the first status query, call it when the
+// program is needed, ready() tells whether that would wait. Without the
+// extension ready() is always true and finish() blocks the calling thread
+// for the whole compile and link.
+class ProgramBatch
+{
+public:
+    // call right after loading glad, looks for the extension and lets the
+    // driver use as many compiler threads as it likes
+    static void init(GLADloadproc load);
+    static bool parallelCompileSupported();
+    
+    size_t add(const std::string &vertexPath, const std::string &fragmentPath,
+               const std::vector<std::string> &defines = {});
+    // already preprocessed, name is only used in logs
+    size_t addSource(const std::string &name, const std::string &vertexCode, const std::string &fragmentCode,
+                     const std::vector<std::string> &files);
+    
+    bool ready(size_t index) const;
+    bool finish(size_t index, GLuint &program);
+    bool finish(size_t index, ShaderProgram &program);
+    // deletes a program that was never finished without waiting for it
+    void discard(size_t index);
+    
+    uint64_t key(size_t index) const { return programs[index].key; }
+    // every file the sources were read from, includes too
+    const std::vector<std::string>& files(size_t index) const { return programs[index].files; }
+
+private:
+    struct Pending
+    {
+        std::string name;
+        std::vector<std::string> files;
+        uint64_t key = 0;
+        GLuint program = 0;
+        GLuint vertexShader = 0;
+        GLuint fragmentShader = 0;
+        bool cached = false;
+        bool failed = false;
+        bool finished = false;
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    std::vector<Pending> programs;
+};
+
+// Programs by permutation, a vertex and fragment shader plus defines. A
+// permutation is preprocessed and submitted when first requested and
+// finished when first fetched, after that get() is a table lookup and
+// switching permutations never compiles. Permutations that preprocess to
+// the same source share one program.
+//
+// A reload resubmits every permutation the library holds from the current
+// sources into a second set. get() keeps returning the old programs until
+// finishReload() swaps the whole set in; call it once reloadReady().
+class ShaderLibrary
+{
+public:
+    // starts compiling without waiting for it
+    void request(const std::string &vertexPath, const std::string &fragmentPath,
+                 const std::vector<std::string> &defines = {});
+    // whether get() would return without waiting for the driver
+    bool ready(const std::string &vertexPath, const std::string &fragmentPath,
+               const std::vector<std::string> &defines = {});
+    // nullptr if the permutation failed to build
+    ShaderProgram* get(const std::string &vertexPath, const std::string &fragmentPath,
+                       const std::vector<std::string> &defines = {});
+    
+    void beginReload();
+    bool reloading() const { return reloadPending; }
+    bool reloadReady() const;
+    // false, keeping the old programs, if any permutation failed to build.
+    // The replaced programs live on until the next reload so the caller can
+    // still switch away from them, other pointers from get() are stale.
+    bool finishReload();
+    
+    // destroys every program, pointers from get() are invalid afterwards
+    void clear();
+    
+    const std::vector<std::string>& sourceFiles() const { return current.files; }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<ShaderProgram> program;     // null until finished
+        size_t batchIndex = 0;
+        bool failed = false;
+    };
+    
+    struct Permutation
+    {
+        std::string vertexPath;
+        std::string fragmentPath;
+        std::vector<std::string> defines;
+        uint64_t source;
+    };
+    
+    struct Set
+    {
+        ProgramBatch batch;
+        std::unordered_map<uint64_t, Permutation> permutations;    // by permutation key
+        std::unordered_map<uint64_t, Entry> programs;              // by source key
+        std::vector<std::string> files;
+    };
+    
+    static uint64_t permutationKey(const std::string &vertexPath, const std::string &fragmentPath,
+                                   std::vector<std::string> defines);
+    static void submit(Set &set, uint64_t permutation, const std::string &vertexPath,
+                       const std::string &fragmentPath, const std::vector<std::string> &defines);
+    static bool finish(Set &set, Entry &entry);
+    static void destroy(Set &set);
+    
+    Set current;
+    Set next;           // being rebuilt by a reload
+    Set replaced;       // before the last reload
+    bool reloadPending = false;
+};
 
 bool getProgram(std::string vertexPath, std::string fragmentPath, GLuint &program);
+bool getProgram(std::string vertexPath, std::string fragmentPath, ShaderProgram &program);
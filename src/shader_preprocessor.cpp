@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "shader_preprocessor.h"
+
+static bool readFile(const std::string &path, std::string &text)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ\n" << path << std::endl;
+        return false;
+    }
+    
+    std::stringstream stream;
+    stream << file.rdbuf();
+    text = stream.str();
+    return true;
+}
+
+static std::string directoryOf(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// the quoted name of an #include line, empty if it isn't one
+static std::string includeName(const std::string &line)
+{
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include"))
+        return "";
+    
+    size_t open = line.find('"', start + 8);
+    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos)
+        return "";
+    return line.substr(open + 1, close - open - 1);
+}
+
+static bool expand(
+    const std::string &path,
+    const std::vector<std::string> &defines,
+    std::vector<std::string> &stack,
+    std::string &code,
+    std::vector<std::string> &files)
+{
+    if (std::find(stack.begin(), stack.end(), path) != stack.end()) {
+        std::cout << "ERROR::SHADER::RECURSIVE_INCLUDE\n" << path << std::endl;
+        return false;
+    }
+    
+    std::string text;
+    if (!readFile(path, text))
+        return false;
+    
+    size_t fileIndex = std::find(files.begin(), files.end(), path) - files.begin();
+    if (fileIndex == files.size())
+        files.push_back(path);
+    
+    stack.push_back(path);
+    
+    std::istringstream lines(text);
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        
+        std::string include = includeName(line);
+        if (!include.empty()) {
+            std::string includePath = directoryOf(path) + include;
+            size_t includeIndex = std::find(files.begin(), files.end(), includePath) - files.begin();
+            code += "#line 1 " + std::to_string(includeIndex) + "\n";
+            if (!expand(includePath, {}, stack, code, files))
+                return false;
+            code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+            continue;
+        }
+        
+        code += line + "\n";
+        
+        // defines have to come after #version, which has to be first
+        if (!defines.empty() && !line.compare(0, 8, "#version")) {
+            for (const std::string &define : defines) {
+                std::string value = define;
+                size_t equals = value.find('=');
+                if (equals != std::string::npos)
+                    value[equals] = ' ';
+                code += "#define " + value + "\n";
+            }
+            code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+        }
+    }
+    
+    stack.pop_back();
+    return true;
+}
+
+bool preprocessShader(
+    const std::string &path,
+    const std::vector<std::string> &defines,
+    std::string &code,
+    std::vector<std::string> &files)
+{
+    std::vector<std::string> stack;
+    code.clear();
+    files.clear();
+    return expand(path, defines, stack, code, files);
+}
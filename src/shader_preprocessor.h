@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Expands #include "file" (relative to the including file) and injects
+// defines after the #version line. Defines are "NAME" or "NAME=VALUE", a
+// bare name is a feature keyword tested with #ifdef. #line directives keep
+// compiler messages pointing at the right line, the source number is the
+// file's position in files.
+bool preprocessShader(
+    const std::string &path,
+    const std::vector<std::string> &defines,
+    std::string &code,
+    std::vector<std::string> &files);
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define COOKER_SSE
+#endif
+
+#include <stb_image.h>
+
+#include "image_decoder.h"
+#include "texture_cooker.h"
+#include "trace.h"
+
+// === mip filter =====================================
+void downsample(const unsigned char *src, unsigned int width, unsigned int height, unsigned int channels,
+                unsigned char *dst)
+{
+    // odd sizes drop the last row or column, same level sizes as GL's own
+    unsigned int dstWidth = std::max(1u, width / 2);
+    unsigned int dstHeight = std::max(1u, height / 2);
+    size_t pitch = (size_t) width * channels;
+    
+    for (unsigned int y = 0; y < dstHeight; y++) {
+        const unsigned char *row0 = src + std::min(2 * y, height - 1) * pitch;
+        const unsigned char *row1 = src + std::min(2 * y + 1, height - 1) * pitch;
+        unsigned char *out = dst + (size_t) y * dstWidth * channels;
+        unsigned int x = 0;
+        
+#ifdef COOKER_SSE
+        // 8 source pixels from each row make 4 output pixels
+        if (channels == 4 && width > 1) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i round = _mm_set1_epi16(2);
+            for (; x + 4 <= dstWidth; x += 4) {
+                __m128i a = _mm_loadu_si128((const __m128i*) (row0 + x * 8));
+                __m128i b = _mm_loadu_si128((const __m128i*) (row0 + x * 8 + 16));
+                __m128i c = _mm_loadu_si128((const __m128i*) (row1 + x * 8));
+                __m128i d = _mm_loadu_si128((const __m128i*) (row1 + x * 8 + 16));
+                
+                // vertical sums, two pixels per register in 16-bit lanes
+                __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero));
+                __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero));
+                __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero));
+                __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero));
+                
+                // horizontal neighbours are the two 64-bit halves
+                __m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+                __m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+                h0 = _mm_srli_epi16(_mm_add_epi16(h0, round), 2);
+                h1 = _mm_srli_epi16(_mm_add_epi16(h1, round), 2);
+                _mm_storeu_si128((__m128i*) (out + x * 4), _mm_packus_epi16(h0, h1));
+            }
+        }
+#endif
+        
+        for (; x < dstWidth; x++) {
+            unsigned int x0 = std::min(2 * x, width - 1) * channels;
+            unsigned int x1 = std::min(2 * x + 1, width - 1) * channels;
+            for (unsigned int c = 0; c < channels; c++)
+                out[x * channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+        }
+    }
+}
+
+// === block compression ==============================
+static uint16_t to565(const float color[3])
+{
+    int r = (int) std::lround(color[0] * 31.0f / 255.0f);
+    int g = (int) std::lround(color[1] * 63.0f / 255.0f);
+    int b = (int) std::lround(color[2] * 31.0f / 255.0f);
+    return (r << 11) | (g << 5) | b;
+}
+
+static void from565(uint16_t color, int rgb[3])
+{
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// endpoints at the extremes of the colors' principal axis, pulled in a little
+// so the interpolated colors land on the actual spread
+static void colorEndpoints(const unsigned char rgba[64], float end0[3], float end1[3])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += rgba[i * 4 + c] * (1.0f / 16.0f);
+    
+    float cov[6] = {};   // xx xy xz yy yz zz
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { rgba[i * 4] - mean[0], rgba[i * 4 + 1] - mean[1], rgba[i * 4 + 2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    
+    // power iteration converges on the dominant axis in a few steps, starting
+    // from the widest channel's column so the start is never orthogonal to it
+    int widest = cov[0] >= cov[3] ? (cov[0] >= cov[5] ? 0 : 2) : (cov[3] >= cov[5] ? 1 : 2);
+    float axis[3] = {
+        widest == 0 ? cov[0] : widest == 1 ? cov[1] : cov[2],
+        widest == 0 ? cov[1] : widest == 1 ? cov[3] : cov[4],
+        widest == 0 ? cov[2] : widest == 1 ? cov[4] : cov[5]
+    };
+    for (int step = 0; step < 8; step++) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+        float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+        if (length < 1e-6f)
+            break;  // flat block, any axis works
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+    
+    float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (int c = 0; c < 3; c++)
+        axis[c] = length > 1e-6f ? axis[c] / length : 0.0f;
+    
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < 3; c++)
+            t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    
+    float inset = (maxT - minT) / 16.0f;
+    for (int c = 0; c < 3; c++) {
+        end0[c] = std::max(0.0f, std::min(255.0f, mean[c] + axis[c] * (maxT - inset)));
+        end1[c] = std::max(0.0f, std::min(255.0f, mean[c] + axis[c] * (minT + inset)));
+    }
+}
+
+static void encodeColor(const unsigned char rgba[64], unsigned char block[8])
+{
+    float end0[3], end1[3];
+    colorEndpoints(rgba, end0, end1);
+    
+    // the larger endpoint first selects the four color mode
+    uint16_t color0 = to565(end0), color1 = to565(end1);
+    if (color0 < color1)
+        std::swap(color0, color1);
+    
+    int palette[4][3];
+    from565(color0, palette[0]);
+    from565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = rgba[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+    
+    block[0] = color0 & 0xff;
+    block[1] = color0 >> 8;
+    block[2] = color1 & 0xff;
+    block[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++)
+        block[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+void encodeBC1(const unsigned char rgba[64], unsigned char block[8])
+{
+    encodeColor(rgba, block);
+}
+
+void encodeBC3(const unsigned char rgba[64], unsigned char block[16])
+{
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; i++) {
+        alpha0 = std::max<int>(alpha0, rgba[i * 4 + 3]);
+        alpha1 = std::min<int>(alpha1, rgba[i * 4 + 3]);
+    }
+    
+    // alpha0 > alpha1 selects eight interpolated values
+    int palette[8] = { alpha0, alpha1 };
+    for (int i = 1; i < 7; i++)
+        palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+    
+    uint64_t indices = 0;
+    if (alpha0 != alpha1) {
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestError = 256;
+            for (int p = 0; p < 8; p++) {
+                int error = std::abs(rgba[i * 4 + 3] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t) best << (3 * i);
+        }
+    }
+    
+    block[0] = alpha0;
+    block[1] = alpha1;
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (indices >> (8 * i)) & 0xff;
+    encodeColor(rgba, block + 8);
+}
+
+static std::vector<unsigned char> compressLevel(const unsigned char *rgba, unsigned int width, unsigned int height,
+                                                TextureFormat format)
+{
+    unsigned int blockSize = format == TEXTURE_BC1 ? 8 : 16;
+    unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    std::vector<unsigned char> blocks((size_t) blocksWide * blocksHigh * blockSize);
+    
+    unsigned char pixels[64];
+    for (unsigned int by = 0; by < blocksHigh; by++) {
+        for (unsigned int bx = 0; bx < blocksWide; bx++) {
+            // edge blocks repeat the last row and column
+            for (unsigned int i = 0; i < 16; i++) {
+                unsigned int x = std::min(bx * 4 + i % 4, width - 1);
+                unsigned int y = std::min(by * 4 + i / 4, height - 1);
+                memcpy(pixels + i * 4, rgba + ((size_t) y * width + x) * 4, 4);
+            }
+            
+            unsigned char *block = &blocks[((size_t) by * blocksWide + bx) * blockSize];
+            if (format == TEXTURE_BC1)
+                encodeBC1(pixels, block);
+            else
+                encodeBC3(pixels, block);
+        }
+    }
+    
+    return blocks;
+}
+
+// === cache ==========================================
+// levels down to and including 1x1
+static uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+        count++;
+    return count;
+}
+
+// bytes one level takes in the cache
+static uint64_t levelBytes(uint32_t format, uint32_t channels, uint32_t width, uint32_t height)
+{
+    if (format == TEXTURE_RAW)
+        return (uint64_t) width * height * channels;
+    uint64_t blocks = ((uint64_t) width + 3) / 4 * (((uint64_t) height + 3) / 4);
+    return blocks * (format == TEXTURE_BC1 ? 8 : 16);
+}
+
+static bool mapCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime, bool compress,
+                     CookedTexture &texture)
+{
+    if (!texture.file.open(cachePath))
+        return false;
+    
+    const unsigned char *data = texture.file.data();
+    size_t size = texture.file.size();
+    const TextureCacheHeader *header = (const TextureCacheHeader*) data;
+    const TextureLevel *levels = (const TextureLevel*) (data + sizeof(TextureCacheHeader));
+    
+    if (size < sizeof(TextureCacheHeader)
+        || memcmp(header->magic, "GTTC", 4)
+        || header->version != TEXTURE_CACHE_VERSION
+        || header->sourceSize != sourceSize
+        || header->sourceTime != sourceTime
+        || header->format > TEXTURE_BC3
+        || (header->format != TEXTURE_RAW) != compress
+        || header->channels < 1 || header->channels > 4
+        || !header->width || !header->height
+        || header->levelCount != mipLevelCount(header->width, header->height)
+        || sizeof(TextureCacheHeader) + (uint64_t) header->levelCount * sizeof(TextureLevel) > size) {
+        texture.file.close();
+        return false;
+    }
+    
+    // the loader copies by each level's dimensions, so those have to be the
+    // full chain, and every level exactly as large as its format says and
+    // inside the file
+    for (uint32_t i = 0; i < header->levelCount; i++) {
+        const TextureLevel &level = levels[i];
+        if (level.width != std::max(1u, header->width >> i)
+            || level.height != std::max(1u, header->height >> i)
+            || level.size != levelBytes(header->format, header->channels, level.width, level.height)
+            || level.offset > size || level.size > size - level.offset) {
+            texture.file.close();
+            return false;
+        }
+    }
+    
+    texture.header = header;
+    texture.levels = levels;
+    return true;
+}
+
+static bool writeCache(const std::string &path, const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime,
+                       bool compress)
+{
+    TRACE_SCOPE("cook texture");
+    auto start = std::chrono::steady_clock::now();
+    
+    int width, height, channels;
+    unsigned char *pixels = decodeImage(path, width, height, channels, compress ? 4 : 0);
+    if (!pixels) {
+        std::cout << "ERROR::TEXTURE::DECODE_FAILED\n" << path << std::endl;
+        return false;
+    }
+    unsigned int stored = compress ? 4 : channels;
+    
+    TextureFormat format = TEXTURE_RAW;
+    if (compress) {
+        format = TEXTURE_BC1;
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            if (pixels[i * 4 + 3] != 255) {
+                format = TEXTURE_BC3;
+                break;
+            }
+        }
+    }
+    
+    // filter every level from the one above, then encode each one
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<TextureLevel> table;
+    levels.emplace_back(pixels, pixels + (size_t) width * height * stored);
+    stbi_image_free(pixels);
+    
+    unsigned int w = width, h = height;
+    size_t rawBytes = 0;
+    for (;;) {
+        TextureLevel level = {};
+        level.width = w;
+        level.height = h;
+        table.push_back(level);
+        rawBytes += (size_t) w * h * stored;
+        if (w == 1 && h == 1)
+            break;
+        
+        std::vector<unsigned char> next((size_t) std::max(1u, w / 2) * std::max(1u, h / 2) * stored);
+        downsample(levels.back().data(), w, h, stored, next.data());
+        levels.push_back(std::move(next));
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    
+    if (format != TEXTURE_RAW) {
+        for (size_t i = 0; i < levels.size(); i++)
+            levels[i] = compressLevel(levels[i].data(), table[i].width, table[i].height, format);
+    }
+    
+    TextureCacheHeader header = {};
+    memcpy(header.magic, "GTTC", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.format = format;
+    header.channels = channels;
+    header.width = width;
+    header.height = height;
+    header.levelCount = levels.size();
+    
+    uint64_t offset = sizeof(header) + table.size() * sizeof(TextureLevel);
+    for (size_t i = 0; i < levels.size(); i++) {
+        table[i].offset = offset;
+        table[i].size = levels[i].size();
+        offset += levels[i].size();
+    }
+    
+    // write to a temporary name first so a crash never leaves a truncated cache behind
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) table.data(), table.size() * sizeof(TextureLevel));
+    for (const std::vector<unsigned char> &level : levels)
+        file.write((const char*) level.data(), level.size());
+    file.close();
+    
+    if (!file) {
+        std::cout << "ERROR::TEXTURE::CACHE_NOT_WRITABLE\n" << cachePath << std::endl;
+        return false;
+    }
+    
+    std::remove(cachePath.c_str());
+    if (std::rename(tempPath.c_str(), cachePath.c_str()))
+        return false;
+    
+    static const char *formatNames[] = { "raw", "BC1", "BC3" };
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Cooked texture " << path << " (" << width << "x" << height << ", " << levels.size()
+              << " levels, " << formatNames[format] << ") in " << ms << " ms, "
+              << rawBytes / 1024 << " KB uncompressed, " << (offset - table[0].offset) / 1024 << " KB cooked"
+              << std::endl;
+    return true;
+}
+
+bool cookTexture(const std::string &path, bool compress, CookedTexture &texture)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!fileStamp(path, sourceSize, sourceTime)) {
+        std::cout << "ERROR::TEXTURE::FILE_NOT_FOUND\n" << path << std::endl;
+        return false;
+    }
+    
+    std::string cachePath = path + ".texcache";
+    if (mapCache(cachePath, sourceSize, sourceTime, compress, texture))
+        return true;
+    
+    if (!writeCache(path, cachePath, sourceSize, sourceTime, compress))
+        return false;
+    if (!mapCache(cachePath, sourceSize, sourceTime, compress, texture)) {
+        std::cout << "ERROR::TEXTURE::CACHE_NOT_READABLE\n" << cachePath << std::endl;
+        return false;
+    }
+    return true;
+}
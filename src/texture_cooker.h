@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.h"
+
+// Textures are decoded once and written to a cache next to the source
+// ("<image>.texcache") with the whole mip chain filtered on the cpu and,
+// when asked for, block compressed. Later runs map the cache and upload
+// the levels as they are, nothing is decoded or filtered.
+
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+enum TextureFormat
+{
+    TEXTURE_RAW,    // channels bytes per pixel, rows tightly packed
+    TEXTURE_BC1,    // 8 bytes per 4x4 block, opaque
+    TEXTURE_BC3     // 16 bytes per 4x4 block, bc1 color plus interpolated alpha
+};
+
+struct TextureCacheHeader
+{
+    char magic[4];              // "GTTC"
+    uint32_t version;
+    uint64_t sourceSize;        // source image this cache was built from,
+    int64_t sourceTime;         // rebuilt when either one changes
+    uint32_t format;            // TextureFormat
+    uint32_t channels;          // of the source, bc formats always decode to rgba
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t padding;
+};
+
+// follows the header, one per mip level, largest first
+struct TextureLevel
+{
+    uint64_t offset;            // from the start of the file
+    uint32_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t padding;
+};
+
+// Points straight into the mapped cache file.
+struct CookedTexture
+{
+    MappedFile file;
+    const TextureCacheHeader *header = nullptr;
+    const TextureLevel *levels = nullptr;
+    
+    const unsigned char* levelData(unsigned int level) const { return file.data() + levels[level].offset; }
+};
+
+// maps the cache, cooking it first if it's missing, stale or in the other format
+bool cookTexture(const std::string &path, bool compress, CookedTexture &texture);
+
+// next mip level of an 8-bit image, 2x2 box filter, sse2 for 4 channels
+void downsample(const unsigned char *src, unsigned int width, unsigned int height, unsigned int channels,
+                unsigned char *dst);
+
+// one 4x4 block of rgba pixels
+void encodeBC1(const unsigned char rgba[64], unsigned char block[8]);
+void encodeBC3(const unsigned char rgba[64], unsigned char block[16]);
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "texture_loader.h"
+#include "trace.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+struct PixelFormat
+{
+    GLint internalFormat;
+    GLenum format;
+    GLint swizzle[4];
+    unsigned int blockSize;     // bytes per 4x4 block, 0 for uncompressed
+};
+
+// grey and grey+alpha images are stored in one and two channels and
+// swizzled back out, so nothing gets expanded to rgba on the cpu
+static PixelFormat pixelFormat(const TextureCacheHeader &header)
+{
+    if (header.format == TEXTURE_BC1)
+        return { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE }, 8 };
+    if (header.format == TEXTURE_BC3)
+        return { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA }, 16 };
+    
+    switch (header.channels) {
+    case 1:  return { GL_R8, GL_RED, { GL_RED, GL_RED, GL_RED, GL_ONE }, 0 };
+    case 2:  return { GL_RG8, GL_RG, { GL_RED, GL_RED, GL_RED, GL_GREEN }, 0 };
+    case 3:  return { GL_RGB8, GL_RGB, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE }, 0 };
+    default: return { GL_RGBA8, GL_RGBA, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA }, 0 };
+    }
+}
+
+static bool s3tcSupported()
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        if (!strcmp(name, "GL_EXT_texture_compression_s3tc"))
+            return true;
+    }
+    return false;
+}
+
+bool TextureLoader::create(bool compressed, unsigned int threads, size_t budget)
+{
+    if (!threads) {
+        // leave a core for the render thread, hardware_concurrency may be 0 if unknown
+        unsigned int cores = std::thread::hardware_concurrency();
+        threads = cores > 1 ? cores - 1 : 1;
+    }
+    
+    compress = compressed && s3tcSupported();
+    if (compressed && !compress)
+        std::cout << "S3TC texture compression unavailable, textures stay uncompressed" << std::endl;
+    
+    uploadBudget = budget;
+    glGenBuffers(1, &unpackBuffer);
+    
+    stopping = false;
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&TextureLoader::work, this);
+    return true;
+}
+
+void TextureLoader::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+    workers.clear();
+    
+    requests.clear();
+    decoded.clear();
+    pending = 0;
+    
+    glDeleteBuffers(1, &unpackBuffer);
+    unpackBuffer = 0;
+}
+
+GLuint TextureLoader::load(const std::string &path)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    
+    // set the texture wrapping/filtering options (on the currently bound texture object)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    
+    const unsigned char checker[16] = {
+        255, 0, 255, 255,   64, 64, 64, 255,
+        64, 64, 64, 255,    255, 0, 255, 255
+    };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+    
+    Image image;
+    image.texture = texture;
+    image.path = path;
+    image.start = std::chrono::steady_clock::now();
+    
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(std::move(image));
+    }
+    wake.notify_one();
+    return texture;
+}
+
+void TextureLoader::work()
+{
+    traceThreadName("texture decode");
+    
+    for (;;) {
+        Image image;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            image = std::move(requests.front());
+            requests.pop_front();
+        }
+        
+        {
+            TRACE_SCOPE("map texture");
+            image.cooked.reset(new CookedTexture());
+            if (cookTexture(image.path, compress, *image.cooked)) {
+                // fault the pages in here rather than in the middle of an upload
+                const volatile unsigned char *data = image.cooked->file.data();
+                unsigned int sum = 0;
+                for (size_t i = 0; i < image.cooked->file.size(); i += 4096)
+                    sum += data[i];
+                (void) sum;
+            } else {
+                image.cooked.reset();
+            }
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.push_back(std::move(image));
+    }
+}
+
+// every level is defined up front, sampling is held to the ones already uploaded
+void TextureLoader::allocate(Image &image)
+{
+    const CookedTexture &cooked = *image.cooked;
+    PixelFormat format = pixelFormat(*cooked.header);
+    unsigned int levelCount = cooked.header->levelCount;
+    
+    glBindTexture(GL_TEXTURE_2D, image.texture);
+    for (unsigned int level = 0; level < levelCount; level++) {
+        const TextureLevel &info = cooked.levels[level];
+        if (format.blockSize)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format.internalFormat, info.width, info.height, 0,
+                                   info.size, NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, format.internalFormat, info.width, info.height, 0,
+                         format.format, GL_UNSIGNED_BYTE, NULL);
+    }
+    
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    image.allocated = true;
+}
+
+// true once the last row of the largest level is up
+bool TextureLoader::uploadRows(Image &image, size_t &budget)
+{
+    const CookedTexture &cooked = *image.cooked;
+    PixelFormat format = pixelFormat(*cooked.header);
+    unsigned int level = cooked.header->levelCount - 1 - image.uploadedLevels;
+    const TextureLevel &info = cooked.levels[level];
+    
+    // compressed levels go up in rows of blocks
+    unsigned int rowHeight = format.blockSize ? 4 : 1;
+    unsigned int rowCount = (info.height + rowHeight - 1) / rowHeight;
+    size_t rowSize = format.blockSize ? (size_t) (info.width + 3) / 4 * format.blockSize
+                                      : (size_t) info.width * cooked.header->channels;
+    
+    glBindTexture(GL_TEXTURE_2D, image.texture);
+    
+    // at least one row so a budget below the row size still makes progress
+    unsigned int rows = std::max<size_t>(1, std::min<size_t>(budget / rowSize, rowCount - image.uploadedRows));
+    size_t size = rows * rowSize;
+    budget -= std::min(budget, size);
+    
+    // orphaning keeps the driver from waiting on the previous strip
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        memcpy(mapped, cooked.levelData(level) + image.uploadedRows * rowSize, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    
+    unsigned int y = image.uploadedRows * rowHeight;
+    unsigned int height = std::min(rows * rowHeight, info.height - y);
+    if (format.blockSize) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, info.width, height, format.internalFormat,
+                                  size, (void*) 0);
+    } else {
+        // rgb and grey rows aren't 4 byte aligned in general
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, info.width, height, format.format, GL_UNSIGNED_BYTE, (void*) 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    image.uploadedRows += rows;
+    if (image.uploadedRows < rowCount)
+        return false;
+    
+    // the finished level becomes the sharpest one sampled
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    image.uploadedLevels++;
+    image.uploadedRows = 0;
+    return level == 0;
+}
+
+void TextureLoader::update()
+{
+    TRACE_SCOPE("upload textures");
+    
+    static const char *formatNames[] = { "raw", "BC1", "BC3" };
+    
+    size_t budget = uploadBudget;
+    while (budget) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (decoded.empty())
+            break;
+        Image &image = decoded.front();
+        lock.unlock();
+        
+        // only this thread touches decoded.front(), workers append at the back
+        if (!image.cooked) {
+            std::cout << "Failed to load texture " << image.path << std::endl;
+        } else {
+            if (!image.allocated)
+                allocate(image);
+            
+            bool done = false;
+            while (budget && !done)
+                done = uploadRows(image, budget);
+            if (!done)
+                break;      // budget spent mid image, carry on next frame
+            
+            const TextureCacheHeader &header = *image.cooked->header;
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - image.start).count();
+            std::cout << "Loaded texture " << image.path << " (" << header.width << "x" << header.height
+                      << ", " << header.levelCount << " levels, " << formatNames[header.format] << ") in "
+                      << ms << " ms" << std::endl;
+        }
+        
+        lock.lock();
+        decoded.pop_front();
+        pending--;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad.h>
+
+#include "texture_cooker.h"
+
+// Loads textures without stalling frames. load() returns a texture that
+// holds a checkerboard placeholder right away; a worker thread maps the
+// cooked cache of the file (see texture_cooker.h) and update() on the GL
+// thread streams the levels in through a pixel unpack buffer, at most
+// uploadBudget bytes per call. Levels go up smallest first, in strips of
+// rows over several frames, and the base level follows them so the image
+// sharpens as it arrives. The texture name never changes, so it can be
+// bound before the real image arrives.
+class TextureLoader
+{
+public:
+    // compress falls back to raw levels when the driver has no s3tc
+    bool create(bool compress = true, unsigned int threads = 0, size_t uploadBudget = 4 << 20);
+    void destroy();
+    
+    GLuint load(const std::string &path);
+    void update();
+    
+    // nothing waiting to be decoded or uploaded
+    bool idle() const { return pending == 0; }
+
+private:
+    struct Image
+    {
+        GLuint texture;
+        std::string path;
+        std::unique_ptr<CookedTexture> cooked;  // null if cooking failed
+        bool allocated = false;
+        unsigned int uploadedLevels = 0;        // counted from the smallest
+        unsigned int uploadedRows = 0;          // of the level in progress
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    void work();
+    void allocate(Image &image);
+    bool uploadRows(Image &image, size_t &budget);
+    
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Image> requests;     // waiting for a worker
+    std::deque<Image> decoded;      // waiting for update()
+    bool stopping = false;
+    std::atomic<unsigned int> pending { 0 };
+    
+    GLuint unpackBuffer = 0;
+    size_t uploadBudget = 0;
+    bool compress = false;
+};
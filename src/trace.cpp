@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "trace.h"
+
+std::atomic<bool> traceEnabled(false);
+
+static const unsigned int MAX_THREADS = 64;
+static const unsigned int BUFFER_EVENTS = 1 << 16;
+
+struct TraceRecord
+{
+    const char *name;
+    int64_t start;
+    int64_t end;
+};
+
+// fields are relaxed atomics because a dump may read a slot while the
+// owner overwrites it, the head check afterwards throws such slots away
+struct SharedRecord
+{
+    std::atomic<const char*> name;
+    std::atomic<int64_t> start;
+    std::atomic<int64_t> end;
+};
+
+// single writer (the owning thread), any number of readers
+struct TraceBuffer
+{
+    SharedRecord records[BUFFER_EVENTS];
+    std::atomic<uint64_t> head;
+    std::atomic<const char*> name;
+    unsigned int tid;
+};
+
+static std::atomic<TraceBuffer*> buffers[MAX_THREADS];
+static std::atomic<unsigned int> bufferCount(0);
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+int64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static TraceBuffer* threadBuffer()
+{
+    thread_local TraceBuffer *buffer = nullptr;
+    if (buffer)
+        return buffer;
+    
+    unsigned int slot = bufferCount.fetch_add(1);
+    if (slot >= MAX_THREADS)
+        return nullptr;
+    
+    // never freed, a dump may still read it after the thread is gone
+    buffer = new TraceBuffer();
+    buffer->head.store(0, std::memory_order_relaxed);
+    buffer->name.store(nullptr, std::memory_order_relaxed);
+    buffer->tid = slot + 1;
+    buffers[slot].store(buffer, std::memory_order_release);
+    return buffer;
+}
+
+void traceEvent(const char *name, int64_t start, int64_t end)
+{
+    TraceBuffer *buffer = threadBuffer();
+    if (!buffer)
+        return;
+    
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    SharedRecord &record = buffer->records[head % BUFFER_EVENTS];
+    // a reader that sees any of the stores below also sees the previous head
+    std::atomic_thread_fence(std::memory_order_release);
+    record.name.store(name, std::memory_order_relaxed);
+    record.start.store(start, std::memory_order_relaxed);
+    record.end.store(end, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void traceThreadName(const char *name)
+{
+    TraceBuffer *buffer = threadBuffer();
+    if (buffer)
+        buffer->name.store(name, std::memory_order_release);
+}
+
+bool dumpTrace(const std::string &path)
+{
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "ERROR::TRACE::FILE_NOT_WRITABLE\n" << path << std::endl;
+        return false;
+    }
+    
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    size_t written = 0;
+    
+    std::vector<TraceRecord> records;
+    unsigned int count = std::min(bufferCount.load(), MAX_THREADS);
+    for (unsigned int i = 0; i < count; i++) {
+        TraceBuffer *buffer = buffers[i].load(std::memory_order_acquire);
+        if (!buffer)
+            continue;
+        
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t tail = head > BUFFER_EVENTS ? head - BUFFER_EVENTS : 0;
+        records.resize(head - tail);
+        for (uint64_t j = 0; j < head - tail; j++) {
+            const SharedRecord &record = buffer->records[(tail + j) % BUFFER_EVENTS];
+            records[j].name = record.name.load(std::memory_order_relaxed);
+            records[j].start = record.start.load(std::memory_order_relaxed);
+            records[j].end = record.end.load(std::memory_order_relaxed);
+        }
+        
+        // the owner kept writing while we copied, drop whatever it may have
+        // overwritten, including the slot of the event it's writing right now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = buffer->head.load(std::memory_order_relaxed);
+        size_t skip = after + 1 > BUFFER_EVENTS + tail ? std::min<uint64_t>(after + 1 - BUFFER_EVENTS - tail, records.size()) : 0;
+        
+        const char *name = buffer->name.load(std::memory_order_acquire);
+        file << (first ? "" : ",")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+             << ",\"args\":{\"name\":\"" << (name ? name : "thread " + std::to_string(buffer->tid)) << "\"}}";
+        first = false;
+        
+        for (size_t j = skip; j < records.size(); j++) {
+            const TraceRecord &r = records[j];
+            file << ",{\"name\":\"" << r.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                 << ",\"ts\":" << r.start / 1000.0 << ",\"dur\":" << (r.end - r.start) / 1000.0 << "}";
+            written++;
+        }
+    }
+    
+    file << "]}" << std::endl;
+    std::cout << "Trace written to " << path << " (" << written << " events)" << std::endl;
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline capture in the Chrome Trace Event format (opens in Perfetto and
+// chrome://tracing). Every thread records into its own fixed ring buffer,
+// allocated on the thread's first event, so recording takes no locks and
+// no allocations. Event names must be string literals.
+
+extern std::atomic<bool> traceEnabled;
+
+void traceEvent(const char *name, int64_t start, int64_t end);
+void traceThreadName(const char *name);
+int64_t traceNow();     // nanoseconds on the trace clock
+
+// writes the events still held in all thread buffers, returns false if the file can't be written
+bool dumpTrace(const std::string &path);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : name(name), start(traceEnabled ? traceNow() : -1) {}
+    ~TraceScope()
+    {
+        if (start >= 0)
+            traceEvent(name, start, traceNow());
+    }
+
+private:
+    const char *name;
+    int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
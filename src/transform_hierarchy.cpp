@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define HIERARCHY_SSE
+#endif
+
+#include "transform_hierarchy.h"
+
+uint32_t TransformHierarchy::add(uint32_t parent, const glm::mat4 &local)
+{
+    uint32_t id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        id = (uint32_t) positions.size();
+        positions.push_back(0);
+        parentIds.push_back(NO_PARENT);
+    }
+    
+    uint32_t i = (uint32_t) ids.size();
+    uint32_t p = parent == NO_PARENT ? NO_PARENT : positions[parent];
+    
+    // appending stays depth first only if the parent's subtree ends here
+    if (p != NO_PARENT && subtreeEnds[p] != i)
+        sorted = false;
+    if (sorted) {
+        for (uint32_t q = p; q != NO_PARENT; q = parents[q])
+            subtreeEnds[q] = i + 1;
+    }
+    
+    ids.push_back(id);
+    parents.push_back(p);
+    subtreeEnds.push_back(i + 1);
+    locals.push_back(local);
+    worlds.push_back(local);
+    dirty.push_back(1);
+    
+    positions[id] = i;
+    parentIds[id] = parent;
+    return id;
+}
+
+void TransformHierarchy::remove(uint32_t node)
+{
+    // leaves a hole that the next sort closes, the id is reused after that
+    ids[positions[node]] = NO_PARENT;
+    removedIds.push_back(node);
+    sorted = false;
+}
+
+void TransformHierarchy::clear()
+{
+    *this = TransformHierarchy();
+}
+
+void TransformHierarchy::setRootOrder(const std::vector<uint32_t> &nodes)
+{
+    rootOrder = nodes;
+    sorted = false;
+}
+
+void TransformHierarchy::sort()
+{
+    // children lists by id, kept in their current order
+    size_t idCount = positions.size();
+    std::vector<uint32_t> firstChild(idCount, NO_PARENT);
+    std::vector<uint32_t> nextSibling(idCount, NO_PARENT);
+    std::vector<uint32_t> roots;
+    for (size_t i = ids.size(); i-- > 0;) {
+        uint32_t id = ids[i];
+        if (id == NO_PARENT)
+            continue;
+        uint32_t &parent = parentIds[id];
+        if (parent != NO_PARENT && ids[positions[parent]] == NO_PARENT)
+            parent = NO_PARENT;
+        if (parent == NO_PARENT) {
+            roots.push_back(id);
+        } else {
+            nextSibling[id] = firstChild[parent];
+            firstChild[parent] = id;
+        }
+    }
+    
+    // roots the caller asked for go first, in its order
+    if (!rootOrder.empty()) {
+        std::vector<uint32_t> ordered;
+        std::vector<uint8_t> placed(idCount, 0);
+        ordered.reserve(roots.size());
+        for (uint32_t id : rootOrder) {
+            if (id < idCount && ids[positions[id]] == id && parentIds[id] == NO_PARENT && !placed[id]) {
+                ordered.push_back(id);
+                placed[id] = 1;
+            }
+        }
+        for (size_t r = roots.size(); r-- > 0;) {
+            if (!placed[roots[r]])
+                ordered.push_back(roots[r]);
+        }
+        std::reverse(ordered.begin(), ordered.end());
+        roots.swap(ordered);
+        rootOrder.clear();
+    }
+    
+    // depth first from every root, the stack holds the next sibling to visit
+    std::vector<uint32_t> order;
+    order.reserve(ids.size());
+    std::vector<uint32_t> stack;
+    for (size_t r = roots.size(); r-- > 0;) {
+        stack.push_back(roots[r]);
+        while (!stack.empty()) {
+            uint32_t id = stack.back();
+            stack.pop_back();
+            order.push_back(id);
+            if (nextSibling[id] != NO_PARENT && parentIds[id] != NO_PARENT)
+                stack.push_back(nextSibling[id]);
+            if (firstChild[id] != NO_PARENT)
+                stack.push_back(firstChild[id]);
+        }
+    }
+    
+    size_t count = order.size();
+    std::vector<glm::mat4> sortedLocals(count);
+    for (size_t i = 0; i < count; i++)
+        sortedLocals[i] = locals[positions[order[i]]];
+    locals.swap(sortedLocals);
+    
+    ids = order;
+    for (size_t i = 0; i < count; i++)
+        positions[ids[i]] = (uint32_t) i;
+    
+    parents.resize(count);
+    subtreeEnds.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t parent = parentIds[ids[i]];
+        parents[i] = parent == NO_PARENT ? NO_PARENT : positions[parent];
+        subtreeEnds[i] = (uint32_t) i + 1;
+    }
+    for (size_t i = count; i-- > 0;) {
+        if (parents[i] != NO_PARENT)
+            subtreeEnds[parents[i]] = std::max(subtreeEnds[parents[i]], subtreeEnds[i]);
+    }
+    
+    worlds.resize(count);
+    dirty.assign(count, 1);
+    freeIds.insert(freeIds.end(), removedIds.begin(), removedIds.end());
+    removedIds.clear();
+    sorted = true;
+}
+
+size_t TransformHierarchy::update()
+{
+    if (!sorted)
+        sort();
+    
+    // every flagged node takes its whole subtree along, flags inside it are covered
+    size_t count = ids.size();
+    size_t updated = 0;
+    const uint8_t *flags = dirty.data();
+    for (size_t i = 0; i < count;) {
+        const uint8_t *next = (const uint8_t*) memchr(flags + i, 1, count - i);
+        if (!next)
+            break;
+        
+        uint32_t begin = (uint32_t) (next - flags);
+        uint32_t end = subtreeEnds[begin];
+        transformRange(parents.data(), locals.data(), worlds.data(), begin, end);
+        memset(&dirty[begin], 0, end - begin);
+        updated += end - begin;
+        i = end;
+    }
+    
+    return updated;
+}
+
+size_t TransformHierarchy::updateAll()
+{
+    if (!sorted)
+        sort();
+    
+    transformRange(parents.data(), locals.data(), worlds.data(), 0, ids.size());
+    std::fill(dirty.begin(), dirty.end(), 0);
+    return ids.size();
+}
+
+void transformRangeScalar(const uint32_t *parents, const glm::mat4 *locals, glm::mat4 *worlds, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        if (parents[i] == TransformHierarchy::NO_PARENT)
+            worlds[i] = locals[i];
+        else
+            worlds[i] = worlds[parents[i]] * locals[i];
+    }
+}
+
+#ifdef HIERARCHY_SSE
+
+void transformRange(const uint32_t *parents, const glm::mat4 *locals, glm::mat4 *worlds, uint32_t begin, uint32_t end)
+{
+    // siblings are adjacent, their parent's columns stay loaded between them
+    uint32_t loaded = TransformHierarchy::NO_PARENT;
+    __m128 p0 = _mm_setzero_ps(), p1 = p0, p2 = p0, p3 = p0;
+    
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t parent = parents[i];
+        const float *local = &locals[i][0][0];
+        float *world = &worlds[i][0][0];
+        
+        if (parent == TransformHierarchy::NO_PARENT) {
+            for (int c = 0; c < 4; c++)
+                _mm_storeu_ps(world + c * 4, _mm_loadu_ps(local + c * 4));
+            continue;
+        }
+        
+        if (parent != loaded) {
+            const float *m = &worlds[parent][0][0];
+            p0 = _mm_loadu_ps(m);
+            p1 = _mm_loadu_ps(m + 4);
+            p2 = _mm_loadu_ps(m + 8);
+            p3 = _mm_loadu_ps(m + 12);
+            loaded = parent;
+        }
+        
+        // column c of the product is the parent's columns weighted by the local column's entries
+        for (int c = 0; c < 4; c++) {
+            const float *column = local + c * 4;
+            __m128 r = _mm_mul_ps(p0, _mm_set1_ps(column[0]));
+            r = _mm_add_ps(r, _mm_mul_ps(p1, _mm_set1_ps(column[1])));
+            r = _mm_add_ps(r, _mm_mul_ps(p2, _mm_set1_ps(column[2])));
+            r = _mm_add_ps(r, _mm_mul_ps(p3, _mm_set1_ps(column[3])));
+            _mm_storeu_ps(world + c * 4, r);
+        }
+    }
+}
+
+const char* transformRangePath()
+{
+    return "sse";
+}
+
+#else
+
+void transformRange(const uint32_t *parents, const glm::mat4 *locals, glm::mat4 *worlds, uint32_t begin, uint32_t end)
+{
+    transformRangeScalar(parents, locals, worlds, begin, end);
+}
+
+const char* transformRangePath()
+{
+    return "scalar";
+}
+
+#endif
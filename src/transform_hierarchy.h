@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm.hpp>
+
+// Parent/child transforms in flat arrays kept in depth-first order: a
+// parent comes before its children and every subtree is one contiguous
+// range. Changing a local transform only flags the node; update() finds
+// the flagged nodes and recomputes each one's subtree as a single range
+// with the batched kernel below. Nodes keep their id when the arrays are
+// reordered.
+class TransformHierarchy
+{
+public:
+    static constexpr uint32_t NO_PARENT = ~0u;
+    
+    // the parent has to exist already. Adding below the branch added last
+    // keeps the order, anything else sorts again on the next update.
+    uint32_t add(uint32_t parent, const glm::mat4 &local);
+    // children of a removed node become roots
+    void remove(uint32_t node);
+    void clear();
+    
+    // lays the roots out in this order at the next sort, so a caller walking
+    // its own array of nodes also walks the hierarchy front to back
+    void setRootOrder(const std::vector<uint32_t> &nodes);
+    
+    // only touches the node's own entries, so jobs may set different nodes
+    // at once. A root without children is its own world, nothing to flag.
+    void setLocal(uint32_t node, const glm::mat4 &local)
+    {
+        uint32_t i = positions[node];
+        locals[i] = local;
+        if (sorted && parents[i] == NO_PARENT && subtreeEnds[i] == i + 1)
+            worlds[i] = local;
+        else
+            dirty[i] = 1;
+    }
+    const glm::mat4& local(uint32_t node) const { return locals[positions[node]]; }
+    const glm::mat4& world(uint32_t node) const { return worlds[positions[node]]; }
+    
+    // world matrices of the flagged subtrees, returns how many were recomputed
+    size_t update();
+    // every world matrix regardless of flags
+    size_t updateAll();
+    
+    size_t size() const { return ids.size(); }
+
+private:
+    void sort();
+    
+    // by position
+    std::vector<uint32_t> ids;          // NO_PARENT for removed nodes until the next sort
+    std::vector<uint32_t> parents;      // position of the parent
+    std::vector<uint32_t> subtreeEnds;  // one past the last descendant
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;
+    
+    // by id
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> parentIds;
+    std::vector<uint32_t> freeIds;
+    std::vector<uint32_t> removedIds;   // free once the next sort dropped them
+    std::vector<uint32_t> rootOrder;
+    
+    bool sorted = true;
+};
+
+// worlds[i] = worlds[parents[i]] * locals[i] for i in [begin, end), roots
+// (NO_PARENT) copy their local. Parents have to precede their children.
+// transformRange keeps the parent's columns in registers across siblings
+// and multiplies with SSE where the build has it.
+void transformRange(const uint32_t *parents, const glm::mat4 *locals, glm::mat4 *worlds, uint32_t begin, uint32_t end);
+void transformRangeScalar(const uint32_t *parents, const glm::mat4 *locals, glm::mat4 *worlds, uint32_t begin, uint32_t end);
+const char* transformRangePath();
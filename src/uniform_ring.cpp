@@ -0,0 +1,91 @@
+#include <iostream>
+
+#include "uniform_ring.h"
+
+bool UniformRing::create(GLsizeiptr regionSize)
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    
+    size = regionSize;
+    stride = (size + alignment - 1) / alignment * alignment;
+    region = 0;
+    
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    
+    if (GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, stride * REGIONS, NULL, flags);
+        mapped = (char*) glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * REGIONS, flags);
+        if (!mapped) {
+            std::cout << "ERROR::UNIFORM_RING::MAP_FAILED" << std::endl;
+            return false;
+        }
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, stride * REGIONS, NULL, GL_DYNAMIC_DRAW);
+    }
+    
+    return true;
+}
+
+void UniformRing::destroy()
+{
+    for (GLsync &sync : fences) {
+        glDeleteSync(sync);
+        sync = 0;
+    }
+    
+    if (mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        mapped = nullptr;
+    }
+    
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void* UniformRing::begin()
+{
+    GLsync &sync = fences[region];
+    if (sync) {
+        // flush on the first try in case the fence is still sitting in the command queue
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        GLenum result;
+        do {
+            result = glClientWaitSync(sync, flags, 1000000);
+            flags = 0;
+        } while (result == GL_TIMEOUT_EXPIRED);
+        
+        glDeleteSync(sync);
+        sync = 0;
+    }
+    
+    if (mapped)
+        return mapped + stride * region;
+    
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    void *region = glMapBufferRange(GL_UNIFORM_BUFFER, stride * this->region, size,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!region)
+        std::cout << "ERROR::UNIFORM_RING::MAP_FAILED" << std::endl;
+    return region;
+}
+
+void UniformRing::end(GLuint binding)
+{
+    if (!mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, stride * region, size);
+}
+
+// call after the last draw that reads the current region
+void UniformRing::fence()
+{
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % REGIONS;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glad.h>
+#include <glm.hpp>
+
+// std140 layout, has to match CameraBlock in the shaders
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProj;
+    glm::vec4 cameraPos;    // w is the time in seconds
+};
+
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+// Uniform buffer split into REGIONS slices that are written round-robin,
+// one per frame. A slice is fenced after the frame's draws and only
+// rewritten once the gpu is past that fence, so with three slices the
+// cpu normally never waits. Persistently mapped on GL 4.4, otherwise
+// mapped unsynchronized every frame.
+class UniformRing
+{
+public:
+    static const unsigned int REGIONS = 3;
+    
+    bool create(GLsizeiptr size);
+    void destroy();
+    
+    // nullptr if the slice couldn't be mapped, skip end() then
+    void* begin();
+    void end(GLuint binding);
+    void fence();
+
+private:
+    GLuint buffer = 0;
+    GLsizeiptr size = 0;
+    GLsizeiptr stride = 0;
+    unsigned int region = 0;
+    char *mapped = nullptr;
+    GLsync fences[REGIONS] = {};
+};
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "vertex_layout.h"
+
+struct FormatInfo
+{
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    unsigned int size;
+};
+
+static FormatInfo formatInfo(AttribFormat format)
+{
+    switch (format) {
+    case AttribFormat::Float2:    return { 2, GL_FLOAT, GL_FALSE, 8 };
+    case AttribFormat::Float3:    return { 3, GL_FLOAT, GL_FALSE, 12 };
+    case AttribFormat::Float4:    return { 4, GL_FLOAT, GL_FALSE, 16 };
+    case AttribFormat::Half2:     return { 2, GL_HALF_FLOAT, GL_FALSE, 4 };
+    case AttribFormat::Half4:     return { 4, GL_HALF_FLOAT, GL_FALSE, 8 };
+    case AttribFormat::Unorm16x2: return { 2, GL_UNSIGNED_SHORT, GL_TRUE, 4 };
+    case AttribFormat::Unorm16x4: return { 4, GL_UNSIGNED_SHORT, GL_TRUE, 8 };
+    case AttribFormat::Snorm10x3: return { 4, GL_INT_2_10_10_10_REV, GL_TRUE, 4 };
+    case AttribFormat::Unorm8x4:  return { 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 };
+    }
+    return { 0, GL_FLOAT, GL_FALSE, 0 };
+}
+
+unsigned int formatSize(AttribFormat format)
+{
+    return formatInfo(format).size;
+}
+
+VertexLayout& VertexLayout::add(uint32_t name, AttribFormat format)
+{
+    attribs.push_back({ name, format, stride });
+    stride += (formatSize(format) + 3) & ~3u;
+    return *this;
+}
+
+void applyLayout(const VertexLayout &layout, const ShaderProgram &program)
+{
+    for (const VertexAttrib &attrib : layout.attribs) {
+        GLint location = program.attribLocation(attrib.name);
+        if (location < 0)
+            continue;   // not used by this program
+        
+        FormatInfo info = formatInfo(attrib.format);
+        glVertexAttribPointer(location, info.components, info.type, info.normalized,
+                              layout.stride, (void*) (size_t) attrib.offset);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+void clearLayout(const VertexLayout &layout, const ShaderProgram &program)
+{
+    for (const VertexAttrib &attrib : layout.attribs) {
+        GLint location = program.attribLocation(attrib.name);
+        if (location >= 0)
+            glDisableVertexAttribArray(location);
+    }
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    
+    if (exponent <= 0)
+        return sign;                    // flush denormals to zero
+    if (exponent >= 31)
+        return sign | 0x7c00;           // overflow to infinity
+    // round to nearest
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++;
+    return half;
+}
+
+uint32_t packSnorm10(float x, float y, float z)
+{
+    auto pack = [](float v) {
+        int i = (int) std::lround(std::max(-1.0f, std::min(1.0f, v)) * 511.0f);
+        return (uint32_t) i & 0x3ff;
+    };
+    return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
+
+static uint16_t unorm16(float value)
+{
+    return (uint16_t) std::lround(std::max(0.0f, std::min(1.0f, value)) * 65535.0f);
+}
+
+static void packAttrib(AttribFormat format, const float v[4], unsigned char *out)
+{
+    switch (format) {
+    case AttribFormat::Float2:
+    case AttribFormat::Float3:
+    case AttribFormat::Float4:
+        memcpy(out, v, formatSize(format));
+        break;
+    case AttribFormat::Half2:
+    case AttribFormat::Half4: {
+        uint16_t h[4] = { floatToHalf(v[0]), floatToHalf(v[1]), floatToHalf(v[2]), floatToHalf(v[3]) };
+        memcpy(out, h, formatSize(format));
+        break;
+    }
+    case AttribFormat::Unorm16x2:
+    case AttribFormat::Unorm16x4: {
+        uint16_t u[4] = { unorm16(v[0]), unorm16(v[1]), unorm16(v[2]), unorm16(v[3]) };
+        memcpy(out, u, formatSize(format));
+        break;
+    }
+    case AttribFormat::Snorm10x3: {
+        uint32_t packed = packSnorm10(v[0], v[1], v[2]);
+        memcpy(out, &packed, 4);
+        break;
+    }
+    case AttribFormat::Unorm8x4:
+        for (int i = 0; i < 4; i++)
+            out[i] = (unsigned char) std::lround(std::max(0.0f, std::min(1.0f, v[i])) * 255.0f);
+        break;
+    }
+}
+
+std::vector<unsigned char> packVertices(
+    const VertexLayout &layout,
+    const std::vector<VertexStream> &streams,
+    size_t count)
+{
+    std::vector<unsigned char> packed(layout.stride * count, 0);
+    
+    for (const VertexAttrib &attrib : layout.attribs) {
+        auto stream = std::find_if(streams.begin(), streams.end(),
+                                   [&](const VertexStream &s) { return s.name == attrib.name; });
+        if (stream == streams.end())
+            continue;
+        
+        for (size_t i = 0; i < count; i++) {
+            float v[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+            for (unsigned int c = 0; c < stream->components && c < 4; c++)
+                v[c] = stream->data[i * stream->stride + c];
+            packAttrib(attrib.format, v, &packed[i * layout.stride + attrib.offset]);
+        }
+    }
+    
+    return packed;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glad.h>
+
+#include "shader_loader.h"
+
+enum class AttribFormat
+{
+    Float2,
+    Float3,
+    Float4,
+    Half2,          // GL_HALF_FLOAT
+    Half4,
+    Unorm16x2,      // normalized GL_UNSIGNED_SHORT, [0, 1]
+    Unorm16x4,
+    Snorm10x3,      // normalized GL_INT_2_10_10_10_REV, [-1, 1], w unused
+    Unorm8x4
+};
+
+struct VertexAttrib
+{
+    uint32_t name;          // hashName of the shader input
+    AttribFormat format;
+    unsigned int offset;
+};
+
+// Interleaved vertex format described attribute by attribute. Attributes are
+// placed in the order they're added, each on a 4 byte boundary.
+struct VertexLayout
+{
+    std::vector<VertexAttrib> attribs;
+    unsigned int stride = 0;
+    
+    VertexLayout& add(uint32_t name, AttribFormat format);
+};
+
+// Float source data for one attribute, components floats per vertex.
+struct VertexStream
+{
+    uint32_t name;
+    const float *data;
+    unsigned int components;
+    unsigned int stride;    // in floats between consecutive vertices
+};
+
+// glVertexAttribPointer for every attribute the program uses, on the bound vao and array buffer
+void applyLayout(const VertexLayout &layout, const ShaderProgram &program);
+void clearLayout(const VertexLayout &layout, const ShaderProgram &program);
+
+// converts float streams into the layout, missing components are 0 (w is 1)
+std::vector<unsigned char> packVertices(
+    const VertexLayout &layout,
+    const std::vector<VertexStream> &streams,
+    size_t count);
+
+unsigned int formatSize(AttribFormat format);
+uint16_t floatToHalf(float value);
+uint32_t packSnorm10(float x, float y, float z);
@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <stb_image.h>
+
+#include "image_decoder.h"
+#include "texture_cooker.h"
+#include "trace.h"
+#include "virtual_texture.h"
+
+// === cooking ========================================
+// bilinear, stretches the source over the whole square
+static void resample(const unsigned char *src, unsigned int width, unsigned int height, unsigned char *dst,
+                     unsigned int size)
+{
+    for (unsigned int y = 0; y < size; y++) {
+        float sy = std::max(0.0f, (y + 0.5f) * height / size - 0.5f);
+        unsigned int y0 = std::min((unsigned int) sy, height - 1), y1 = std::min(y0 + 1, height - 1);
+        float fy = sy - y0;
+        
+        for (unsigned int x = 0; x < size; x++) {
+            float sx = std::max(0.0f, (x + 0.5f) * width / size - 0.5f);
+            unsigned int x0 = std::min((unsigned int) sx, width - 1), x1 = std::min(x0 + 1, width - 1);
+            float fx = sx - x0;
+            
+            for (unsigned int c = 0; c < 4; c++) {
+                float top = src[(y0 * width + x0) * 4 + c] * (1.0f - fx) + src[(y0 * width + x1) * 4 + c] * fx;
+                float bottom = src[(y1 * width + x0) * 4 + c] * (1.0f - fx) + src[(y1 * width + x1) * 4 + c] * fx;
+                dst[((size_t) y * size + x) * 4 + c] = (unsigned char) (top * (1.0f - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+static bool mapCache(MappedFile &file, const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime)
+{
+    if (!file.open(cachePath))
+        return false;
+    
+    const VirtualTextureHeader *header = (const VirtualTextureHeader*) file.data();
+    if (file.size() < sizeof(VirtualTextureHeader)
+        || memcmp(header->magic, "GTVT", 4)
+        || header->version != VT_CACHE_VERSION
+        || header->sourceSize != sourceSize
+        || header->sourceTime != sourceTime
+        || header->tileSize != VT_TILE_SIZE
+        || header->border != VT_TILE_BORDER
+        || header->size > VT_MAX_TILES * VT_TILE_SIZE
+        || header->size % VT_TILE_SIZE) {
+        file.close();
+        return false;
+    }
+    
+    // a power of two tiles wide with every level down to a single tile, which
+    // also keeps the level within the bits tileKey() has for it
+    uint32_t tiles = header->size / VT_TILE_SIZE;
+    uint32_t levelCount = 1;
+    while ((1u << (levelCount - 1)) < tiles)
+        levelCount++;
+    if (tiles != 1u << (levelCount - 1)
+        || header->levelCount != levelCount
+        || sizeof(VirtualTextureHeader) + levelCount * sizeof(VirtualTextureLevel) > file.size()) {
+        file.close();
+        return false;
+    }
+    
+    // the page table, tileData() and feedback all trust the level table
+    const VirtualTextureLevel *levels = (const VirtualTextureLevel*) (file.data() + sizeof(VirtualTextureHeader));
+    uint64_t padded = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint64_t bytes = (uint64_t) levels[level].tiles * levels[level].tiles * padded * padded * 4;
+        if (levels[level].tiles != tiles >> level
+            || levels[level].offset > file.size()
+            || bytes > file.size() - levels[level].offset) {
+            file.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool writeCache(const std::string &path, const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime)
+{
+    TRACE_SCOPE("cook virtual texture");
+    auto start = std::chrono::steady_clock::now();
+    
+    int width, height, channels;
+    unsigned char *pixels = decodeImage(path, width, height, channels, 4);
+    if (!pixels) {
+        std::cout << "ERROR::TEXTURE::DECODE_FAILED\n" << path << std::endl;
+        return false;
+    }
+    
+    // square and a power of two tiles wide, so every level halves the tile count exactly
+    unsigned int tiles = 1;
+    while (tiles * VT_TILE_SIZE < (unsigned int) std::max(width, height))
+        tiles *= 2;
+    unsigned int size = tiles * VT_TILE_SIZE;
+    if (tiles > VT_MAX_TILES) {
+        std::cout << "ERROR::TEXTURE::TOO_LARGE\n" << path << " (" << width << "x" << height
+                  << ", at most " << VT_MAX_TILES * VT_TILE_SIZE << " texels per side)" << std::endl;
+        stbi_image_free(pixels);
+        return false;
+    }
+    
+    std::vector<unsigned char> image((size_t) size * size * 4);
+    resample(pixels, width, height, image.data(), size);
+    stbi_image_free(pixels);
+    
+    VirtualTextureHeader header = {};
+    memcpy(header.magic, "GTVT", 4);
+    header.version = VT_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.sourceWidth = width;
+    header.sourceHeight = height;
+    header.size = size;
+    header.tileSize = VT_TILE_SIZE;
+    header.border = VT_TILE_BORDER;
+    for (unsigned int t = tiles; t; t /= 2)
+        header.levelCount++;
+    
+    const unsigned int padded = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+    const size_t tileBytes = (size_t) padded * padded * 4;
+    
+    std::vector<VirtualTextureLevel> table(header.levelCount);
+    uint64_t offset = sizeof(header) + table.size() * sizeof(VirtualTextureLevel);
+    for (unsigned int level = 0; level < header.levelCount; level++) {
+        table[level].offset = offset;
+        table[level].tiles = tiles >> level;
+        offset += (uint64_t) table[level].tiles * table[level].tiles * tileBytes;
+    }
+    
+    // write to a temporary name first so a crash never leaves a truncated cache behind
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) table.data(), table.size() * sizeof(VirtualTextureLevel));
+    
+    std::vector<unsigned char> tile(tileBytes);
+    for (unsigned int level = 0; level < header.levelCount; level++) {
+        unsigned int levelSize = size >> level;
+        for (unsigned int ty = 0; ty < table[level].tiles; ty++) {
+            for (unsigned int tx = 0; tx < table[level].tiles; tx++) {
+                // borders wrap around like GL_REPEAT
+                for (unsigned int y = 0; y < padded; y++) {
+                    unsigned int sy = (ty * VT_TILE_SIZE + y + levelSize - VT_TILE_BORDER) % levelSize;
+                    for (unsigned int x = 0; x < padded; x++) {
+                        unsigned int sx = (tx * VT_TILE_SIZE + x + levelSize - VT_TILE_BORDER) % levelSize;
+                        memcpy(&tile[((size_t) y * padded + x) * 4], &image[((size_t) sy * levelSize + sx) * 4], 4);
+                    }
+                }
+                file.write((const char*) tile.data(), tile.size());
+            }
+        }
+        
+        if (level + 1 < header.levelCount) {
+            std::vector<unsigned char> next((size_t) levelSize / 2 * levelSize / 2 * 4);
+            downsample(image.data(), levelSize, levelSize, 4, next.data());
+            image.swap(next);
+        }
+    }
+    file.close();
+    
+    if (!file) {
+        std::cout << "ERROR::TEXTURE::CACHE_NOT_WRITABLE\n" << cachePath << std::endl;
+        return false;
+    }
+    
+    std::remove(cachePath.c_str());
+    if (std::rename(tempPath.c_str(), cachePath.c_str()))
+        return false;
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Cooked virtual texture " << path << " (" << width << "x" << height << " -> " << size << "x"
+              << size << ", " << header.levelCount << " levels of " << VT_TILE_SIZE << " texel tiles) in "
+              << ms << " ms" << std::endl;
+    return true;
+}
+
+// === streaming ======================================
+bool VirtualTexture::create(const std::string &path, unsigned int pageCount, unsigned int screenWidth,
+                            unsigned int screenHeight, unsigned int scale, unsigned int uploads)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!fileStamp(path, sourceSize, sourceTime)) {
+        std::cout << "ERROR::TEXTURE::FILE_NOT_FOUND\n" << path << std::endl;
+        return false;
+    }
+    
+    std::string cachePath = path + ".vtcache";
+    if (!mapCache(file, cachePath, sourceSize, sourceTime)) {
+        if (!writeCache(path, cachePath, sourceSize, sourceTime))
+            return false;
+        if (!mapCache(file, cachePath, sourceSize, sourceTime)) {
+            std::cout << "ERROR::TEXTURE::CACHE_NOT_READABLE\n" << cachePath << std::endl;
+            return false;
+        }
+    }
+    header = (const VirtualTextureHeader*) file.data();
+    levels = (const VirtualTextureLevel*) (file.data() + sizeof(VirtualTextureHeader));
+    uploadsPerFrame = uploads;
+    
+    // square atlas that stays within the page budget, page coordinates fit the 8-bit page table
+    pagesPerSide = std::min(255u, std::max(2u, (unsigned int) std::sqrt((double) pageCount)));
+    pages.assign(pagesPerSide * pagesPerSide, Page());
+    unsigned int padded = header->tileSize + 2 * header->border;
+    unsigned int atlasSize = pagesPerSide * padded;
+    
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    // one texel per tile, a level per virtual level, fetched with texelFetch
+    glGenTextures(1, &pageTable);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    size_t entryCount = 0;
+    for (unsigned int level = 0; level < header->levelCount; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levels[level].tiles, levels[level].tiles, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        entryCount += levels[level].tiles * levels[level].tiles;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    entries.assign(entryCount, 0);
+    
+    // === feedback target ================================
+    feedbackScale = std::max(1u, scale);
+    feedbackWidth = std::max(1u, screenWidth / feedbackScale);
+    feedbackHeight = std::max(1u, screenHeight / feedbackScale);
+    glGenRenderbuffers(1, &feedbackColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackWidth, feedbackHeight);
+    glGenRenderbuffers(1, &feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+    
+    GLint framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glGenFramebuffers(1, &feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE\n" << status << std::endl;
+        destroy();
+        return false;
+    }
+    
+    glGenBuffers(READBACKS, readbackBuffers);
+    for (unsigned int i = 0; i < READBACKS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    // the single tile of the coarsest level is the fallback for everything, it never leaves
+    uint32_t root = tileKey(header->levelCount - 1, 0, 0);
+    upload(root);
+    pages[resident[root]].lastUsed = 0xffffffff;
+    updatePageTable();
+    
+    std::cout << "Virtual texture " << path << ": " << header->size << "x" << header->size << ", "
+              << header->levelCount << " levels, atlas of " << pages.size() << " pages (" << atlasSize << "x"
+              << atlasSize << ", " << (size_t) atlasSize * atlasSize * 4 / (1024 * 1024.0) << " MB)";
+    if (pages.size() != pageCount)
+        std::cout << ", " << pageCount << " requested";
+    std::cout << std::endl;
+    return true;
+}
+
+void VirtualTexture::destroy()
+{
+    for (unsigned int i = 0; i < READBACKS; i++) {
+        if (readbackFences[i])
+            glDeleteSync(readbackFences[i]);
+        readbackFences[i] = 0;
+    }
+    glDeleteBuffers(READBACKS, readbackBuffers);
+    glDeleteFramebuffers(1, &feedbackFramebuffer);
+    glDeleteRenderbuffers(1, &feedbackColor);
+    glDeleteRenderbuffers(1, &feedbackDepth);
+    glDeleteTextures(1, &atlas);
+    glDeleteTextures(1, &pageTable);
+    feedbackFramebuffer = feedbackColor = feedbackDepth = atlas = pageTable = 0;
+    readbackCount = 0;
+    
+    pages.clear();
+    resident.clear();
+    file.close();
+    header = nullptr;
+    levels = nullptr;
+}
+
+const unsigned char* VirtualTexture::tileData(uint32_t key) const
+{
+    unsigned int level = key >> 24, y = (key >> 12) & 0xfff, x = key & 0xfff;
+    size_t padded = header->tileSize + 2 * header->border;
+    return file.data() + levels[level].offset + ((size_t) y * levels[level].tiles + x) * padded * padded * 4;
+}
+
+// into a free page or the least recently used one, false if every page was used this frame
+bool VirtualTexture::upload(uint32_t key)
+{
+    uint32_t best = EMPTY;
+    for (uint32_t i = 0; i < pages.size(); i++) {
+        if (pages[i].tile == EMPTY) {
+            best = i;
+            break;
+        }
+        if (pages[i].lastUsed < feedbackFrame && (best == EMPTY || pages[i].lastUsed < pages[best].lastUsed))
+            best = i;
+    }
+    if (best == EMPTY)
+        return false;
+    
+    Page &page = pages[best];
+    if (page.tile != EMPTY) {
+        resident.erase(page.tile);
+        evictions++;
+    }
+    
+    unsigned int padded = header->tileSize + 2 * header->border;
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, best % pagesPerSide * padded, best / pagesPerSide * padded, padded, padded,
+                    GL_RGBA, GL_UNSIGNED_BYTE, tileData(key));
+    
+    page.tile = key;
+    page.lastUsed = feedbackFrame;
+    resident[key] = best;
+    pageTableDirty = true;
+    uploads++;
+    return true;
+}
+
+void VirtualTexture::beginFeedback()
+{
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback()
+{
+    // with every buffer still in flight the gpu is behind, skip this one
+    if (readbackCount < READBACKS) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[readbackHead]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*) 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackFences[readbackHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readbackHead = (readbackHead + 1) % READBACKS;
+        readbackCount++;
+    }
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+void VirtualTexture::processFeedback(const unsigned char *pixels)
+{
+    TRACE_SCOPE("process feedback");
+    feedbackFrame++;
+    feedbackFrames++;
+    
+    // neighbouring pixels mostly want the same tile, drop those repeats before sorting
+    requests.clear();
+    uint32_t previous = EMPTY;
+    for (size_t i = 0; i < (size_t) feedbackWidth * feedbackHeight; i++) {
+        const unsigned char *pixel = pixels + i * 4;
+        if (pixel[3] != 255)
+            continue;
+        unsigned int level = pixel[2], x = pixel[0], y = pixel[1];
+        if (level >= header->levelCount || x >= levels[level].tiles || y >= levels[level].tiles)
+            continue;
+        uint32_t key = tileKey(level, x, y);
+        if (key != previous)
+            requests.push_back(key);
+        previous = key;
+    }
+    
+    // ancestors are the fallback while a tile streams in, keep them fresh too
+    size_t wanted = requests.size();
+    for (size_t i = 0; i < wanted; i++) {
+        uint32_t key = requests[i];
+        for (unsigned int level = (key >> 24) + 1; level < header->levelCount; level++) {
+            unsigned int shift = level - (key >> 24);
+            requests.push_back(tileKey(level, (key & 0xfff) >> shift, ((key >> 12) & 0xfff) >> shift));
+        }
+    }
+    std::sort(requests.begin(), requests.end());
+    requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+    
+    // touch what's resident, keep what's missing
+    size_t missing = 0;
+    for (uint32_t key : requests) {
+        auto it = resident.find(key);
+        if (it != resident.end())
+            pages[it->second].lastUsed = std::max(pages[it->second].lastUsed, feedbackFrame);
+        else
+            requests[missing++] = key;
+    }
+    requests.resize(missing);
+    
+    // coarse levels first, they cover the most pixels
+    std::stable_sort(requests.begin(), requests.end(), [](uint32_t a, uint32_t b) { return (a >> 24) > (b >> 24); });
+    
+    unsigned int count = 0;
+    for (uint32_t key : requests) {
+        if (count++ == uploadsPerFrame || !upload(key))
+            break;      // the rest are asked for again by the next feedback
+    }
+}
+
+void VirtualTexture::update()
+{
+    TRACE_SCOPE("virtual texture");
+    
+    while (readbackCount) {
+        unsigned int oldest = (readbackHead + READBACKS - readbackCount) % READBACKS;
+        GLenum status = glClientWaitSync(readbackFences[oldest], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(readbackFences[oldest]);
+        readbackFences[oldest] = 0;
+        readbackCount--;
+        
+        // only the newest finished feedback matters
+        if (readbackCount) {
+            GLenum next = glClientWaitSync(readbackFences[(oldest + 1) % READBACKS], 0, 0);
+            if (next == GL_ALREADY_SIGNALED || next == GL_CONDITION_SATISFIED)
+                continue;
+        }
+        
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[oldest]);
+        const unsigned char *pixels = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+            (GLsizeiptr) feedbackWidth * feedbackHeight * 4, GL_MAP_READ_BIT);
+        if (pixels) {
+            processFeedback(pixels);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    updatePageTable();
+}
+
+// every tile points at its own page, or inherits the entry of its parent
+void VirtualTexture::updatePageTable()
+{
+    if (!pageTableDirty)
+        return;
+    pageTableDirty = false;
+    
+    std::vector<size_t> offsets(header->levelCount);
+    for (unsigned int level = 1; level < header->levelCount; level++)
+        offsets[level] = offsets[level - 1] + levels[level - 1].tiles * levels[level - 1].tiles;
+    
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    for (int level = header->levelCount - 1; level >= 0; level--) {
+        unsigned int tiles = levels[level].tiles;
+        uint32_t *entry = &entries[offsets[level]];
+        for (unsigned int y = 0; y < tiles; y++) {
+            for (unsigned int x = 0; x < tiles; x++, entry++) {
+                auto it = resident.find(tileKey(level, x, y));
+                if (it != resident.end())
+                    *entry = it->second % pagesPerSide | it->second / pagesPerSide << 8 | level << 16 | 0xffu << 24;
+                else if (level + 1 < (int) header->levelCount)
+                    *entry = entries[offsets[level + 1] + (y / 2) * levels[level + 1].tiles + x / 2];
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tiles, tiles, GL_RGBA, GL_UNSIGNED_BYTE, &entries[offsets[level]]);
+    }
+}
+
+void VirtualTexture::bind(GLuint atlasUnit, GLuint pageTableUnit) const
+{
+    glActiveTexture(GL_TEXTURE0 + atlasUnit);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void VirtualTexture::setUniforms(ShaderProgram &program, bool feedback) const
+{
+    float padded = header->tileSize + 2.0f * header->border;
+    program.set(hashName("vtAtlas"), 1);
+    program.set(hashName("vtPageTable"), 2);
+    program.set(hashName("vtParams"), glm::vec4(header->size, header->tileSize, header->border, pagesPerSide * padded));
+    
+    // the feedback target is smaller, its derivatives are larger by the same factor
+    float bias = feedback ? -std::log2((float) feedbackScale) : 0.0f;
+    program.set(hashName("vtLevels"), glm::vec4(header->levelCount - 1, bias, 0.0f, 0.0f));
+}
+
+void VirtualTexture::report() const
+{
+    std::cout << "virtual texture: " << resident.size() << "/" << pages.size() << " pages resident, "
+              << uploads << " uploads, " << evictions << " evictions, " << feedbackFrames << " feedback frames"
+              << std::endl;
+}
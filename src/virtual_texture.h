@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad.h>
+
+#include "mapped_file.h"
+#include "shader_loader.h"
+
+// Virtual texturing for images too large to keep resident. The source is
+// cooked once into "<image>.vtcache": resampled to a square power of two
+// number of tiles, mip mapped down to a single tile, and every level cut
+// into VT_TILE_SIZE tiles with a VT_TILE_BORDER texel border for bilinear
+// filtering across tile edges.
+//
+// At runtime only a fixed number of tiles live in a physical atlas. Each
+// frame the scene is also drawn at low resolution with the VT_FEEDBACK
+// shader permutation, which writes the tile and level every pixel wants.
+// That image is read back asynchronously; the tiles it names are marked
+// used, missing ones are uploaded a few per frame coarse levels first, and
+// when the atlas is full the least recently used tile is evicted. A page
+// table texture maps every virtual tile to its atlas page, or to the
+// nearest coarser level that is resident, so sampling never misses.
+
+const uint32_t VT_CACHE_VERSION = 1;
+const unsigned int VT_TILE_SIZE = 128;
+const unsigned int VT_TILE_BORDER = 1;
+const unsigned int VT_MAX_TILES = 256;     // per side, feedback writes tile coordinates to 8-bit channels
+
+struct VirtualTextureHeader
+{
+    char magic[4];              // "GTVT"
+    uint32_t version;
+    uint64_t sourceSize;        // source image this cache was built from,
+    int64_t sourceTime;         // rebuilt when either one changes
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+    uint32_t size;              // virtual size in texels, square
+    uint32_t tileSize;
+    uint32_t border;
+    uint32_t levelCount;
+};
+
+// follows the header, one per level, finest first; rgba8 tiles in row order
+struct VirtualTextureLevel
+{
+    uint64_t offset;
+    uint32_t tiles;             // per side
+    uint32_t padding;
+};
+
+class VirtualTexture
+{
+public:
+    // pageCount caps the atlas, and with it the memory the texture can use;
+    // feedback is rendered at 1/feedbackScale of the screen size
+    bool create(const std::string &path, unsigned int pageCount, unsigned int screenWidth,
+                unsigned int screenHeight, unsigned int feedbackScale = 4, unsigned int uploadsPerFrame = 8);
+    void destroy();
+    
+    // draw the scene with the feedback permutation between these two;
+    // end queues the readback and restores the previous framebuffer
+    void beginFeedback();
+    void endFeedback();
+    
+    // consumes finished readbacks, streams tiles and refreshes the page table
+    void update();
+    
+    void bind(GLuint atlasUnit, GLuint pageTableUnit) const;
+    void setUniforms(ShaderProgram &program, bool feedback) const;
+    void report() const;
+
+private:
+    struct Page
+    {
+        uint32_t tile = EMPTY;      // tileKey, EMPTY when free
+        uint32_t lastUsed = 0;      // feedback frame, pinned pages never age
+    };
+    
+    static const uint32_t EMPTY = 0xffffffff;
+    static const unsigned int READBACKS = 3;
+    
+    static uint32_t tileKey(unsigned int level, unsigned int x, unsigned int y) { return level << 24 | y << 12 | x; }
+    
+    const unsigned char* tileData(uint32_t key) const;
+    bool upload(uint32_t key);
+    void processFeedback(const unsigned char *pixels);
+    void updatePageTable();
+    
+    MappedFile file;
+    const VirtualTextureHeader *header = nullptr;
+    const VirtualTextureLevel *levels = nullptr;
+    
+    GLuint atlas = 0;
+    GLuint pageTable = 0;
+    unsigned int pagesPerSide = 0;
+    std::vector<Page> pages;
+    std::unordered_map<uint32_t, uint32_t> resident;    // tileKey -> page
+    std::vector<uint32_t> entries;                      // page table, every level back to back
+    bool pageTableDirty = true;
+    
+    GLuint feedbackFramebuffer = 0;
+    GLuint feedbackColor = 0;
+    GLuint feedbackDepth = 0;
+    unsigned int feedbackWidth = 0, feedbackHeight = 0;
+    unsigned int feedbackScale = 1;
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4] = {};
+    
+    GLuint readbackBuffers[READBACKS] = {};
+    GLsync readbackFences[READBACKS] = {};
+    unsigned int readbackHead = 0;      // next buffer to read into
+    unsigned int readbackCount = 0;     // queued and not yet processed
+    
+    std::vector<uint32_t> requests;
+    unsigned int uploadsPerFrame = 0;
+    uint32_t feedbackFrame = 0;
+    
+    // totals for report()
+    size_t uploads = 0;
+    size_t evictions = 0;
+    size_t feedbackFrames = 0;
+};